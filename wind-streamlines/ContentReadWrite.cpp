@@ -1,140 +1,662 @@
 #include "ContentReadWrite.h"
 
 #include "Conversions.h"
+#include "MappedFile.h"
 #include "rendering/Renderable.h"
+#include "streamlines/Streamline.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+#include <rapidjson/memorystream.h>
+#include <rapidjson/reader.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <string>
 #include <vector>
 
 
-// Reads in json data from file
+// SAX handler that turns GeoJSON line geometry into GL_LINES vertex arrays without building a document
 //
-// path - path of json file to read
-// return - rapidjson document containing file data
-rapidjson::Document ContentReadWrite::readJSON(const char* path) {
+// Every innermost array of positions (a LineString, or one line or ring of a MultiLineString, Polygon or
+// MultiPolygon) becomes a polyline. Key order within objects is not fixed, so vertices of a geometry are
+// added as they are parsed and dropped again when the object ends if its type turns out not to be a line
+class GeoJSONHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, GeoJSONHandler> {
 
-	// Open file
-	std::ifstream file(path);
-	if (!file.is_open()) {
-		std::cout << "Could not open file" << std::endl;
-		return nullptr;
+public:
+	GeoJSONHandler(const glm::u8vec3& colour) :
+		colour(colour),
+		expect(Expect::NONE),
+		coordDepth(0),
+		numCoords(0),
+		havePrev(false) {}
+
+	std::vector<glm::vec3> vertsHigh;
+	std::vector<glm::vec3> vertsLow;
+	std::vector<glm::u8vec3> colours;
+
+	bool StartObject() {
+		expect = Expect::NONE;
+		objects.push_back({ std::string(), vertsHigh.size(), false });
+		return true;
+	}
+
+	bool Key(const char* str, rapidjson::SizeType length, bool) {
+		if (coordDepth == 0) {
+			std::string key(str, length);
+			expect = (key == "type") ? Expect::TYPE : (key == "coordinates") ? Expect::COORDINATES : Expect::NONE;
+		}
+		return true;
 	}
 
-	// Get file length
-	file.seekg(0, file.end);
-	int length = (int) file.tellg();
-	file.seekg(0, file.beg);
+	bool String(const char* str, rapidjson::SizeType length, bool) {
+		if (expect == Expect::TYPE && !objects.empty()) {
+			objects.back().type.assign(str, length);
+		}
+		expect = Expect::NONE;
+		return true;
+	}
 
-	// Read file into buffer and parse
-	char* buffer = new char[length + 1];
-	file.read(buffer, length);
-	file.close();
-	buffer[length] = 0;
+	bool EndObject(rapidjson::SizeType) {
 
-	// Create JSON document
-	rapidjson::Document d;
-	rapidjson::ParseResult ok = d.Parse<rapidjson::kParseStopWhenDoneFlag>(buffer);
+		// Discard anything that was added for points or unknown geometry
+		const Object& o = objects.back();
+		if (o.hasCoords && o.type != "LineString" && o.type != "MultiLineString" && o.type != "Polygon" && o.type != "MultiPolygon") {
+			vertsHigh.resize(o.mark);
+			vertsLow.resize(o.mark);
+			colours.resize(o.mark);
+		}
+		objects.pop_back();
+		return true;
+	}
+
+	bool StartArray() {
+		if (expect == Expect::COORDINATES && !objects.empty()) {
+			objects.back().hasCoords = true;
+			coordDepth = 1;
+		}
+		else if (coordDepth > 0) {
+			coordDepth++;
+		}
+		expect = Expect::NONE;
+		numCoords = 0;
+		return true;
+	}
+
+	bool EndArray(rapidjson::SizeType) {
+		if (coordDepth == 0) {
+			return true;
+		}
+		coordDepth--;
+
+		// End of a position adds a point, end of anything else ends the current line
+		if (numCoords >= 2) {
+			addPoint();
+		}
+		else {
+			havePrev = false;
+		}
+		if (coordDepth == 0) {
+			havePrev = false;
+		}
+		numCoords = 0;
+		return true;
+	}
+
+	bool Double(double d) { return number(d); }
+	bool Int(int i) { return number(i); }
+	bool Uint(unsigned int i) { return number(i); }
+	bool Int64(int64_t i) { return number((double)i); }
+	bool Uint64(uint64_t i) { return number((double)i); }
+
+	bool Default() {
+		expect = Expect::NONE;
+		return true;
+	}
+
+private:
+	enum class Expect {
+		NONE,
+		TYPE,
+		COORDINATES
+	};
+
+	struct Object {
+		std::string type;
+		size_t mark;
+		bool hasCoords;
+	};
+
+	glm::u8vec3 colour;
+
+	std::vector<Object> objects;
+	Expect expect;
+
+	int coordDepth;
+	int numCoords;
+	double coords[2];
+
+	bool havePrev;
+	glm::dvec3 prev;
+
+	// Store longitude and latitude of current position. Altitude is ignored
+	bool number(double d) {
+		if (coordDepth > 0 && numCoords < 2) {
+			coords[numCoords] = d;
+		}
+		numCoords++;
+		expect = Expect::NONE;
+		return true;
+	}
+
+	// Add current position to the line. Each point after the first closes a segment
+	void addPoint() {
+		double lng = coords[0] * M_PI / 180.0;
+		double lat = coords[1] * M_PI / 180.0;
+		glm::dvec3 p = glm::dvec3(sin(lng)*cos(lat), sin(lat), cos(lng)*cos(lat)) * RADIUS_EARTH_M;
+
+		if (havePrev) {
+			addVert(prev);
+			addVert(p);
+		}
+		prev = p;
+		havePrev = true;
+	}
+
+	// Split vertex into high and low precision parts like DoublePrecisionRenderable::addVert
+	void addVert(const glm::dvec3& v) {
+		glm::vec3 high = v;
+		vertsHigh.push_back(high);
+		vertsLow.push_back(v - (glm::dvec3)high);
+		colours.push_back(colour);
+	}
+};
+
+
+// Reads line geometry from a GeoJSON file straight into a renderable. File is mapped and parsed with the SAX
+// reader so no document is built. LineString, MultiLineString, Polygon and MultiPolygon geometries are supported,
+// polygon rings are drawn as outlines
+//
+// path - path of GeoJSON file
+// colour - colour of lines
+// r - renderable to fill
+// return - true if file was parsed
+bool ContentReadWrite::readGeoJSON(const char* path, const glm::u8vec3& colour, ColourRenderable& r) {
+
+	MappedFile file(path);
+	if (!file.isOpen()) {
+		std::cout << "Could not open file " << path << std::endl;
+		return false;
+	}
+
+	GeoJSONHandler handler(colour);
+	rapidjson::MemoryStream stream(file.getData(), file.getSize());
+	rapidjson::Reader reader;
+	rapidjson::ParseResult ok = reader.Parse(stream, handler);
 
 	if (!ok) {
-		rapidjson::ParseErrorCode error = ok.Code();
-		std::cout << "error parsing JSON file: " << error << std::endl;
+		std::cout << "error parsing GeoJSON file " << path << ": " << ok.Code() << std::endl;
+		return false;
+	}
+
+	r.setArrays(handler.vertsHigh.data(), handler.vertsLow.data(), handler.colours.data(), handler.vertsHigh.size());
+	r.setDrawMode(GL_LINES);
+	return true;
+}
+
+
+// Loads GeoJSON layers in parallel. Each layer comes from its binary geometry cache next to the source if that is
+// up to date, otherwise it is parsed and the cache is rewritten. Only CPU side data is touched so GPU buffers
+// still need to be set up on the GL thread afterwards
+//
+// layers - files to load and renderables to fill
+// return - number of layers that were loaded
+int ContentReadWrite::loadGeoJSONLayers(const std::vector<GeoJSONLayer>& layers) {
+
+	std::vector<std::future<bool>> loads;
+	for (const GeoJSONLayer& l : layers) {
+		loads.push_back(std::async(std::launch::async, [l]() {
+
+			std::string cachePath = std::filesystem::path(l.path).replace_extension(".bin").string();
+			if (l.optional && !std::filesystem::exists(l.path) && !std::filesystem::exists(cachePath)) {
+				return false;
+			}
+			if (readGeometry(cachePath.c_str(), l.path, l.colour, *l.renderable)) {
+				return true;
+			}
+			if (!readGeoJSON(l.path, l.colour, *l.renderable)) {
+				return false;
+			}
+			writeGeometry(cachePath.c_str(), l.colour, *l.renderable);
+			return true;
+		}));
 	}
-	delete[] buffer;
 
-	return d;
+	int loaded = 0;
+	for (std::future<bool>& f : loads) {
+		loaded += f.get();
+	}
+	return loaded;
 }
 
-// Load obj file from path into indexed list data structure
-bool ContentReadWrite::loadOBJ(const char* path, ColourRenderable& r) {
-	printf("Loading OBJ file %s...\n", path);
 
-	FILE * file;
-	file = fopen(path, "r");
-	if (file == NULL) {
-		printf("Cannot open file. Check path.");
-		getchar();
+// Parses a number at the start of a range and moves past it
+//
+// p - start of range, set to the character after the number
+// end - end of range
+// value - parsed value
+// return - true if a number was parsed
+template<typename T>
+static bool parseNumber(const char*& p, const char* end, T& value) {
+	while (p < end && (*p == ' ' || *p == '\t')) {
+		p++;
+	}
+	if (p < end && *p == '+') {
+		p++;
+	}
+	std::from_chars_result res = std::from_chars(p, end, value);
+	if (res.ec != std::errc()) {
 		return false;
 	}
+	p = res.ptr;
+	return true;
+}
+
+
+// Loads an OBJ mesh into indexed triangles. The file is mapped and parsed in place. Faces may be written as v,
+// v/vt, v//vn or v/vt/vn with positive or negative (relative) indices, and polygons are triangulated as fans.
+// Only positions are kept since the renderable has no normal or texture attributes, so vertices are shared
+// between all faces that use the same position
+//
+// path - path of OBJ file
+// colour - colour of every vertex
+// r - renderable to fill
+// return - true if file was loaded
+bool ContentReadWrite::loadOBJ(const char* path, const glm::u8vec3& colour, ColourRenderable& r) {
 
-	std::vector<unsigned int> vertIndices;
-	std::vector<unsigned int> normalIndices;
-	std::vector<unsigned int> uvIndices;
+	MappedFile file(path);
+	if (!file.isOpen()) {
+		std::cout << "Could not open file " << path << std::endl;
+		return false;
+	}
 
-	std::vector<glm::dvec3> verts;
-	std::vector<glm::vec3> normals;
-	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> vertsHigh;
+	std::vector<glm::vec3> vertsLow;
+	std::vector<GLuint> indices;
+	std::vector<long long> face;
 
-	while (true) {
+	const char* p = file.getData();
+	const char* end = p + file.getSize();
+	size_t lineNum = 0;
 
-		char lineHeader[128];
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
+	while (p < end) {
 
-		// else : parse lineHeader
+		const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+		if (lineEnd == nullptr) {
+			lineEnd = end;
+		}
+		const char* next = lineEnd + 1;
+		if (lineEnd > p && lineEnd[-1] == '\r') {
+			lineEnd--;
+		}
+		lineNum++;
 
-		if (strcmp(lineHeader, "v") == 0) {
-			glm::vec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
-			verts.push_back(vertex);
+		while (p < lineEnd && (*p == ' ' || *p == '\t')) {
+			p++;
 		}
-		else if (strcmp(lineHeader, "vt") == 0) {
-			glm::vec2 uv;
-			fscanf(file, "%f %f\n", &uv.x, &uv.y);
-			uv.y = -uv.y;
-			uvs.push_back(uv);
+
+		// Position, optional w is ignored
+		if (lineEnd - p > 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+			p++;
+			double x, y, z;
+			if (!parseNumber(p, lineEnd, x) || !parseNumber(p, lineEnd, y) || !parseNumber(p, lineEnd, z)) {
+				std::cout << path << ":" << lineNum << ": bad vertex" << std::endl;
+				return false;
+			}
+			glm::dvec3 v = (RADIUS_EARTH_M - 5.0) * glm::dvec3(x, y, z);
+			glm::vec3 high = v;
+			vertsHigh.push_back(high);
+			vertsLow.push_back(v - (glm::dvec3)high);
 		}
-		else if (strcmp(lineHeader, "vn") == 0) {
-			glm::vec3 normal;
-			fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z);
-			normals.push_back(normal);
+
+		// Face, only the position index of each corner is used
+		else if (lineEnd - p > 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			p++;
+			face.clear();
+
+			long long index;
+			while (parseNumber(p, lineEnd, index)) {
+				face.push_back((index < 0) ? (long long)vertsHigh.size() + index : index - 1);
+
+				// Skip texture and normal indices
+				while (p < lineEnd && *p != ' ' && *p != '\t') {
+					p++;
+				}
+			}
+
+			// Positive indices may refer to vertices further on so they are checked against the vertex count at the
+			// end. Here they only need to fit in a GLuint
+			if (face.size() < 3 || *std::min_element(face.begin(), face.end()) < 0 ||
+			    *std::max_element(face.begin(), face.end()) > (long long)std::numeric_limits<GLuint>::max()) {
+				std::cout << path << ":" << lineNum << ": bad face" << std::endl;
+				return false;
+			}
+			for (size_t i = 1; i + 1 < face.size(); i++) {
+				indices.push_back((GLuint)face[0]);
+				indices.push_back((GLuint)face[i]);
+				indices.push_back((GLuint)face[i + 1]);
+			}
 		}
-		else if (strcmp(lineHeader, "f") == 0) {
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2]);
 
-			vertIndices.push_back(vertexIndex[0] - 1);
-			vertIndices.push_back(vertexIndex[1] - 1);
-			vertIndices.push_back(vertexIndex[2] - 1);
-			normalIndices.push_back(normalIndex[0] - 1);
-			normalIndices.push_back(normalIndex[1] - 1);
-			normalIndices.push_back(normalIndex[2] - 1);
-			uvIndices.push_back(uvIndex[0] - 1);
-			uvIndices.push_back(uvIndex[1] - 1);
-			uvIndices.push_back(uvIndex[2] - 1);
+		// Anything else (comments, normals, texture coordinates, groups, materials) is skipped
+		p = next;
+	}
 
+	for (GLuint i : indices) {
+		if (i >= vertsHigh.size()) {
+			std::cout << path << ": face index out of range" << std::endl;
+			return false;
 		}
-		else {
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
+	}
+
+	std::vector<glm::u8vec3> colours(vertsHigh.size(), colour);
+	r.setArrays(vertsHigh.data(), vertsLow.data(), colours.data(), vertsHigh.size(), indices.data(), indices.size());
+	r.setDrawMode(GL_TRIANGLES);
+	return true;
+}
+
+
+// Appends raw bytes of a value to a buffer
+template<typename T>
+static void pack(std::vector<char>& data, const T* values, size_t count) {
+	size_t offset = data.size();
+	data.resize(offset + sizeof(T) * count);
+	memcpy(data.data() + offset, values, sizeof(T) * count);
+}
+
+
+// Packs streamlines of all levels into the binary streamline format. Values are stored in native (little) endian
+//
+// "WSTL", uint32 version, uint32 number of levels
+// per level: uint64 number of lines
+// per line: uint64 number of points, points as 3 doubles each in cartesian metres, local times as floats in seconds
+//
+// levels - lines of each level
+// return - packed bytes
+std::vector<char> ContentReadWrite::packStreamlines(const std::vector<std::vector<Streamline>>& levels) {
+
+	std::vector<char> data;
+	uint32_t version = 1;
+	uint32_t numLevels = (uint32_t)levels.size();
+
+	pack(data, "WSTL", 4);
+	pack(data, &version, 1);
+	pack(data, &numLevels, 1);
+
+	for (const std::vector<Streamline>& level : levels) {
+
+		uint64_t numLines = level.size();
+		pack(data, &numLines, 1);
+
+		for (const Streamline& s : level) {
+
+			uint64_t numPoints = s.size();
+			pack(data, &numPoints, 1);
+
+			for (const Eigen::Vector3d& p : s.getPoints()) {
+				pack(data, p.data(), 3);
+			}
+			pack(data, s.getLocalTimes().data(), s.getLocalTimes().size());
 		}
+	}
+	return data;
+}
+
 
+// Writes bytes to a file. Data goes to a temporary file first so readers never see a partial file
+//
+// path - path of file to write
+// data - bytes to write
+// return - true if file was written
+bool ContentReadWrite::writeBinary(const char* path, const std::vector<char>& data) {
+
+	std::string tmpPath = std::string(path) + ".tmp";
+	std::ofstream file(tmpPath, std::ios::binary);
+	if (!file.is_open()) {
+		std::cout << "Could not open file " << tmpPath << std::endl;
+		return false;
 	}
+	file.write(data.data(), data.size());
+	bool written = file.good();
+	file.close();
 
-	for (unsigned int i = 0; i < vertIndices.size(); i++) {
+	// A short write (disk full, I/O error) must not replace the old file
+	if (!written || !file.good()) {
+		std::cout << "Could not write file " << tmpPath << std::endl;
+		std::remove(tmpPath.c_str());
+		return false;
+	}
 
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertIndices[i];
-		unsigned int normalIndex = normalIndices[i];
-		unsigned int uvIndex = uvIndices[i];
+	// Replace in one step so a crash leaves either the old file or the new one
+#ifdef _WIN32
+	bool replaced = MoveFileExA(tmpPath.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool replaced = std::rename(tmpPath.c_str(), path) == 0;
+#endif
+	if (!replaced) {
+		std::cout << "Could not replace file " << path << std::endl;
+		std::remove(tmpPath.c_str());
+	}
+	return replaced;
+}
 
-		// Get the attributes thanks to the index
-		glm::dvec3 vertex = (RADIUS_EARTH_M - 5.0) * verts[vertexIndex];
-		glm::vec3 normal = normals[normalIndex];
-		glm::vec2 uv = uvs[uvIndex];
 
-		// Put the attributes in buffers
-		r.addVert(vertex);
-		r.addColour(glm::u8vec3(76, 76, 76));
-		//r.verts.push_back(vertex);
-		//r.colours.push_back(normal);
-		//r.uvs.push_back(uv);
+// Writes streamlines of all levels to a file in the binary streamline format
+//
+// path - path of file to write
+// levels - lines of each level
+// return - true if file was written
+bool ContentReadWrite::writeStreamlines(const char* path, const std::vector<std::vector<Streamline>>& levels) {
+	return writeBinary(path, packStreamlines(levels));
+}
+
+
+// Reads raw bytes of values from a buffer and moves past them
+//
+// p - read position, advanced past the values
+// end - end of buffer
+// values - values out
+// count - number of values
+// return - false if the buffer is too short
+template<typename T>
+static bool unpack(const char*& p, const char* end, T* values, size_t count) {
+	if ((size_t)(end - p) / sizeof(T) < count) {
+		return false;
 	}
-	r.setDrawMode(GL_TRIANGLES);
-	fclose(file);
+	memcpy(values, p, sizeof(T) * count);
+	p += sizeof(T) * count;
 	return true;
-}
\ No newline at end of file
+}
+
+
+// Reads streamlines of all levels from a file in the binary streamline format, see packStreamlines. Lines are not
+// tied to a field, totals are recomputed from the points
+//
+// path - path of file to read
+// levels - lines of each level out
+// return - true if file was read
+bool ContentReadWrite::readStreamlines(const char* path, std::vector<std::vector<Streamline>>& levels) {
+
+	MappedFile file(path);
+	if (!file.isOpen()) {
+		std::cout << "Could not open file " << path << std::endl;
+		return false;
+	}
+	const char* p = file.getData();
+	const char* end = p + file.getSize();
+
+	char magic[4];
+	uint32_t version, numLevels;
+	if (!unpack(p, end, magic, 4) || !unpack(p, end, &version, 1) || !unpack(p, end, &numLevels, 1) ||
+	    memcmp(magic, "WSTL", 4) != 0 || version != 1) {
+		std::cout << "Not a streamline file " << path << std::endl;
+		return false;
+	}
+
+	std::vector<std::vector<Streamline>> read(numLevels);
+	std::vector<Eigen::Vector3d> points;
+	std::vector<float> times;
+	for (std::vector<Streamline>& level : read) {
+
+		uint64_t numLines;
+		if (!unpack(p, end, &numLines, 1)) {
+			std::cout << "Truncated streamline file " << path << std::endl;
+			return false;
+		}
+
+		for (uint64_t l = 0; l < numLines; l++) {
+
+			// Check size before allocating so a corrupt count cannot ask for more than the file holds
+			uint64_t numPoints;
+			if (!unpack(p, end, &numPoints, 1) ||
+			    numPoints > (uint64_t)(end - p) / (3 * sizeof(double) + sizeof(float))) {
+				std::cout << "Truncated streamline file " << path << std::endl;
+				return false;
+			}
+			points.resize(numPoints);
+			times.resize(numPoints);
+			for (Eigen::Vector3d& pt : points) {
+				unpack(p, end, pt.data(), 3);
+			}
+			unpack(p, end, times.data(), numPoints);
+
+			level.emplace_back(nullptr);
+			for (size_t i = 0; i < numPoints; i++) {
+				level.back().addPoint(cartToSph(points[i]), points[i], times[i]);
+			}
+		}
+	}
+	if (p != end) {
+		std::cout << "Trailing data in streamline file " << path << std::endl;
+		return false;
+	}
+
+	levels = std::move(read);
+	return true;
+}
+
+
+// Header of the binary geometry format. Followed by high parts and low parts of every vertex, indices, then colours
+struct GeometryHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t drawMode;
+	glm::u8vec3 colour;
+	uint8_t pad;
+	uint64_t numVerts;
+	uint64_t numIndices;
+};
+
+static const uint32_t GEOMETRY_VERSION = 3;
+
+
+// Writes static geometry to a file in the binary geometry format so it can be loaded without parsing
+//
+// "WGEO", uint32 version, uint32 draw mode, 3 bytes load colour, 1 byte padding, uint64 number of vertices,
+// uint64 number of indices, high parts as 3 floats each, low parts as 3 floats each, indices as uint32, colours as
+// 3 bytes each
+//
+// path - path of file to write
+// colour - colour the geometry was loaded with, checked when reading so a colour change rebuilds the cache
+// r - renderable to store
+// return - true if file was written
+bool ContentReadWrite::writeGeometry(const char* path, const glm::u8vec3& colour, const ColourRenderable& r) {
+
+	const std::vector<glm::vec3>& high = r.getVertsHigh();
+	const std::vector<glm::vec3>& low = r.getVertsLow();
+	const std::vector<glm::u8vec3>& colours = r.getColours();
+	const std::vector<GLuint>& indices = r.getIndices();
+	if (high.empty() || low.size() != high.size() || colours.size() != high.size()) {
+		return false;
+	}
+
+	GeometryHeader header = { { 'W', 'G', 'E', 'O' }, GEOMETRY_VERSION, r.getDrawMode(), colour, 0, high.size(), indices.size() };
+
+	std::vector<char> data;
+	data.reserve(sizeof(GeometryHeader) + (2 * sizeof(glm::vec3) + sizeof(glm::u8vec3)) * high.size() + sizeof(GLuint) * indices.size());
+	pack(data, &header, 1);
+	pack(data, high.data(), high.size());
+	pack(data, low.data(), low.size());
+	pack(data, indices.data(), indices.size());
+	pack(data, colours.data(), colours.size());
+
+	return writeBinary(path, data);
+}
+
+
+// Loads static geometry from a file in the binary geometry format. The file is mapped and copied straight into
+// the vertex arrays. Cache is ignored if it is missing, malformed, older than the file it was made from, or was
+// loaded with another colour
+//
+// cachePath - path of binary geometry file
+// sourcePath - path of file the cache was generated from
+// colour - colour the geometry should be loaded with
+// r - renderable to fill
+// return - true if geometry was loaded from cache
+bool ContentReadWrite::readGeometry(const char* cachePath, const char* sourcePath, const glm::u8vec3& colour, ColourRenderable& r) {
+
+	std::error_code ec;
+	std::filesystem::file_time_type cacheTime = std::filesystem::last_write_time(cachePath, ec);
+	if (ec) {
+		return false;
+	}
+	std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(sourcePath, ec);
+	if (!ec && sourceTime > cacheTime) {
+		return false;
+	}
+
+	MappedFile file(cachePath);
+	if (!file.isOpen() || file.getSize() < sizeof(GeometryHeader)) {
+		return false;
+	}
+
+	GeometryHeader header;
+	memcpy(&header, file.getData(), sizeof(GeometryHeader));
+	if (memcmp(header.magic, "WGEO", 4) != 0 || header.version != GEOMETRY_VERSION || header.colour != colour) {
+		return false;
+	}
+
+	// Counts are checked against the file size first so a corrupt header cannot overflow the expected size
+	size_t n = header.numVerts;
+	size_t numIndices = header.numIndices;
+	if (n > file.getSize() || numIndices > file.getSize() ||
+	    file.getSize() != sizeof(GeometryHeader) + (2 * sizeof(glm::vec3) + sizeof(glm::u8vec3)) * n + sizeof(GLuint) * numIndices) {
+		return false;
+	}
+
+	const char* body = file.getData() + sizeof(GeometryHeader);
+	const glm::vec3* high = (const glm::vec3*)body;
+	const glm::vec3* low = high + n;
+	const GLuint* indices = (const GLuint*)(low + n);
+	const glm::u8vec3* colours = (const glm::u8vec3*)(indices + numIndices);
+
+	// A stale or corrupt cache could otherwise make draws read past the vertex buffer
+	if (std::any_of(indices, indices + numIndices, [n](GLuint i) { return i >= n; })) {
+		return false;
+	}
+
+	r.setArrays(high, low, colours, n, indices, numIndices);
+	r.setDrawMode(header.drawMode);
+	return true;
+}
@@ -1,14 +1,36 @@
 #pragma once
 
 class ColourRenderable;
+class Streamline;
 
-#include <rapidjson/document.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+
+// GeoJSON file to be loaded as a line overlay. Optional layers are skipped quietly if neither the file nor its cache
+// exists
+struct GeoJSONLayer {
+	const char* path;
+	glm::u8vec3 colour;
+	ColourRenderable* renderable;
+	bool optional;
+};
 
 
 // Namespace for reading and writing files of different formats
 namespace ContentReadWrite {
 
-	rapidjson::Document readJSON(const char* path);
-	bool loadOBJ(const char* path, ColourRenderable& r);
+	bool readGeoJSON(const char* path, const glm::u8vec3& colour, ColourRenderable& r);
+	int loadGeoJSONLayers(const std::vector<GeoJSONLayer>& layers);
+	bool loadOBJ(const char* path, const glm::u8vec3& colour, ColourRenderable& r);
+
+	std::vector<char> packStreamlines(const std::vector<std::vector<Streamline>>& levels);
+	bool writeBinary(const char* path, const std::vector<char>& data);
+	bool writeStreamlines(const char* path, const std::vector<std::vector<Streamline>>& levels);
+	bool readStreamlines(const char* path, std::vector<std::vector<Streamline>>& levels);
+
+	bool writeGeometry(const char* path, const glm::u8vec3& colour, const ColourRenderable& r);
+	bool readGeometry(const char* cachePath, const char* sourcePath, const glm::u8vec3& colour, ColourRenderable& r);
 };
 
@@ -3,6 +3,7 @@
 #include <Eigen/Dense>
 
 #include <cmath>
+#include <vector>
 
 
 // Collection of constants and formulas for converting between units and coordinate systems
@@ -10,9 +11,73 @@ constexpr double RADIUS_EARTH_M = 6371008.0;
 constexpr double RADIAL_DIST_SCALE = 34.222;
 
 
-// mbars to meters above surface of Earth
+// Constants of the barometric formula
+constexpr double STANDARD_PRESSURE_MB = 1013.25;
+constexpr double BARO_HEIGHT_M = 0.3048 * 145366.45;
+constexpr double BARO_EXPONENT = 0.190284;
+
+
+// mbars to meters above surface of Earth. Exact but slow, see mbarsToAlt
+inline double mbarsToAltExact(double mb) {
+	return BARO_HEIGHT_M * (1.0 - pow(mb / STANDARD_PRESSURE_MB, BARO_EXPONENT));
+}
+
+
+// meters above surface of Earth to mbars. Exact but slow, see altToMBars
+inline double altToMBarsExact(double m) {
+	return STANDARD_PRESSURE_MB * pow(1.0 - m / BARO_HEIGHT_M, 1.0 / BARO_EXPONENT);
+}
+
+
+// Lookup tables for the conversions on the integration hot path. Linear interpolation between exact values
+//
+// Pressure table covers [1, 1024] mbars with 64 samples per power of two, so spacing follows the curvature of the
+// formula which grows towards low pressure. Max error is 0.2 m
+// Altitude table covers [0, BARO_HEIGHT_M] with 1024 uniform intervals. Max error is 0.003 mbars
+// Define EXACT_CONVERSIONS to use the exact formulas everywhere, e.g. to compare with --bench conversions
+constexpr int MB_TABLE_OCTAVES = 10;
+constexpr int MB_TABLE_PER_OCTAVE = 64;
+constexpr int ALT_TABLE_SIZE = 1024;
+
+inline const std::vector<double> MB_TO_ALT_TABLE = [] {
+	std::vector<double> t(MB_TABLE_OCTAVES * MB_TABLE_PER_OCTAVE + 1);
+	for (size_t i = 0; i < t.size(); i++) {
+		int octave = (int)i / MB_TABLE_PER_OCTAVE;
+		int j = (int)i % MB_TABLE_PER_OCTAVE;
+		t[i] = mbarsToAltExact(ldexp(1.0 + (double)j / MB_TABLE_PER_OCTAVE, octave));
+	}
+	return t;
+}();
+
+inline const std::vector<double> ALT_TO_MB_TABLE = [] {
+	std::vector<double> t(ALT_TABLE_SIZE + 1);
+	for (size_t i = 0; i < t.size(); i++) {
+		t[i] = altToMBarsExact(BARO_HEIGHT_M * i / ALT_TABLE_SIZE);
+	}
+	return t;
+}();
+
+
+// mbars to meters above surface of Earth. Uses lookup table inside its range
 inline double mbarsToAlt(double mb) {
-	return 0.3048 * 145366.45 * (1.0 - pow(mb / 1013.25, 0.190284));
+
+#ifdef EXACT_CONVERSIONS
+	return mbarsToAltExact(mb);
+#else
+	if (!(mb >= 1.0 && mb < 1024.0)) {
+		return mbarsToAltExact(mb);
+	}
+
+	// mb = m * 2^e with m in [0.5, 1). Octave is e - 1 and the position inside the octave comes from the mantissa
+	int e;
+	double m = frexp(mb, &e);
+	double t = (2.0 * m - 1.0) * MB_TABLE_PER_OCTAVE;
+	int j = (int)t;
+	size_t i = (e - 1) * MB_TABLE_PER_OCTAVE + j;
+
+	double frac = t - j;
+	return (1.0 - frac) * MB_TO_ALT_TABLE[i] + frac * MB_TO_ALT_TABLE[i + 1];
+#endif
 }
 
 
@@ -22,9 +87,21 @@ inline double mbarsToAbs(double mb) {
 }
 
 
-// meters above surface of Earth to mbars
+// meters above surface of Earth to mbars. Uses lookup table inside its range
 inline double altToMBars(double m) {
-	return 1013.25 * pow(1.0 - m / (0.3048 * 145366.45), 1.0 / 0.190284);
+
+#ifdef EXACT_CONVERSIONS
+	return altToMBarsExact(m);
+#else
+	double t = m * (ALT_TABLE_SIZE / BARO_HEIGHT_M);
+	if (!(t >= 0.0 && t < ALT_TABLE_SIZE)) {
+		return altToMBarsExact(m);
+	}
+	int i = (int)t;
+
+	double frac = t - i;
+	return (1.0 - frac) * ALT_TO_MB_TABLE[i] + frac * ALT_TO_MB_TABLE[i + 1];
+#endif
 }
 
 
@@ -34,10 +111,48 @@ inline double absToMBars(double m) {
 }
 
 
+// mbars to meters above surface of Earth for n values
+inline void mbarsToAlt(const double* mb, double* alt, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		alt[i] = mbarsToAlt(mb[i]);
+	}
+}
+
+
+// mbars to meters from centre of Earth for n values
+inline void mbarsToAbs(const double* mb, double* abs, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		abs[i] = mbarsToAbs(mb[i]);
+	}
+}
+
+
+// meters above surface of Earth to mbars for n values
+inline void altToMBars(const double* m, double* mb, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		mb[i] = altToMBars(m[i]);
+	}
+}
+
+
+// meters from centre of Earth to mbars for n values
+inline void absToMBars(const double* m, double* mb, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		mb[i] = absToMBars(m[i]);
+	}
+}
+
+
+// Spherical coordinates (lat, long, altitude) in rads and mbars to cartesian coordinates
+// Cosine of latitude and radius are provided by callers that already have them
+inline Eigen::Vector3d sphToCart(const Eigen::Vector3d& v, double cosLat, double rad) {
+	return Eigen::Vector3d(sin(v.y()) * cosLat, sin(v.x()), cos(v.y()) * cosLat) * rad;
+}
+
+
 // Spherical coordinates (lat, long, altitude) in rads and mbars to cartesian coordinates
 inline Eigen::Vector3d sphToCart(const Eigen::Vector3d& v) {
-	double rad = mbarsToAbs(v.z());
-	return Eigen::Vector3d(sin(v.y()) * cos(v.x()), sin(v.x()), cos(v.y()) * cos(v.x())) * rad;
+	return sphToCart(v, cos(v.x()), mbarsToAbs(v.z()));
 }
 
 
@@ -48,4 +163,13 @@ inline Eigen::Vector3d cartToSph(const Eigen::Vector3d& v) {
 	if (lng < 0.0)
 		lng += 2.0 * M_PI;
 	return Eigen::Vector3d(asin(v.y() / rad), lng, absToMBars(rad));
+}
+
+
+// Cartesian coordinates to (lat, long) in rads, ignoring altitude
+inline Eigen::Vector2d cartToLatLng(const Eigen::Vector3d& v) {
+	double lng = atan2(v.x(), v.z());
+	if (lng < 0.0)
+		lng += 2.0 * M_PI;
+	return Eigen::Vector2d(asin(v.y() / v.norm()), lng);
 }
\ No newline at end of file
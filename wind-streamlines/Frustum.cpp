@@ -4,6 +4,8 @@
 #include "rendering/Camera.h"
 #include "rendering/RenderEngine.h"
 
+#include <algorithm>
+
 
 // Construct frustum from camera and projection matrix information
 //
@@ -13,7 +15,8 @@ Frustum::Frustum(const Camera& c, const RenderEngine& r) :
 	near(r.getNear()),
 	far(r.getFar()),
 	tanAng(tan(r.getFovY() * 0.5)),
-	aspectRatio(r.getAspectRatio()) {
+	aspectRatio(r.getAspectRatio()),
+	pixelHeight(r.getHeight()) {
 
 	glm::dvec3 eyeG = c.getEye();
 	glm::dvec3 dirG = c.getLookDir();
@@ -30,12 +33,21 @@ Frustum::Frustum(const Camera& c, const RenderEngine& r) :
 //
 // p - point in cartesian coordinates
 bool Frustum::pointInside(const Eigen::Vector3d& p) const {
+	return pointInside(p, far);
+}
+
+
+// Test if point is inside frustum and no further than the given distance along the view direction
+//
+// p - point in cartesian coordinates
+// maxDist - maximum distance in front of the eye. Clamped to far plane
+bool Frustum::pointInside(const Eigen::Vector3d& p, double maxDist) const {
 	
 	Eigen::Vector3d v = p - eye;
 
-	// Test to see if between near and far
+	// Test to see if between near and far (or max distance)
 	double vProjForw = v.dot(forw);
-	if (vProjForw > far || vProjForw < near) {
+	if (vProjForw > std::min(far, maxDist) || vProjForw < near) {
 		return false;
 	}
 
@@ -61,11 +73,74 @@ bool Frustum::pointInside(const Eigen::Vector3d& p) const {
 //
 // points - list of points in spherical coordinates
 bool Frustum::overlap(const std::vector<Eigen::Vector3d>& points) const {
+	return overlap(points, far);
+}
+
+
+// Test if list of points has any overlap with frustum closer than the given distance
+//
+// points - list of points in spherical coordinates
+// maxDist - maximum distance in front of the eye. Clamped to far plane
+bool Frustum::overlap(const std::vector<Eigen::Vector3d>& points, double maxDist) const {
 	
 	for (const Eigen::Vector3d& p : points) {
-		if (pointInside(p)) {
+		if (pointInside(p, maxDist)) {
 			return true;
 		}
 	}
 	return false;
+}
+
+
+// Returns furthest distance from the eye at which an object of the given size still covers the given number of pixels
+//
+// size - world size of object in meters
+// pixels - number of pixels it should cover vertically
+// return - distance in front of the eye in meters
+double Frustum::maxDistForPixelSize(double size, double pixels) const {
+	return size * pixelHeight / (2.0 * tanAng * pixels);
+}
+
+
+// Returns the smallest distance along the view direction of any visible point of a sphere centred at the origin.
+// Same measure as maxDistForPixelSize and the maxDist of pointInside
+//
+// radius - radius of sphere in meters
+// return - distance in front of the eye in meters, at least the near plane
+double Frustum::minDepthOfSphere(double radius) const {
+	return std::max(near, -eye.dot(forw) - radius);
+}
+
+
+// Shoots an n by n grid of rays across the view and returns where they hit the surface of the Earth
+//
+// n - number of rays in each direction
+// maxDist - hits deeper than this along the view direction are ignored
+// return - list of hit points in cartesian coordinates
+std::vector<Eigen::Vector3d> Frustum::groundPoints(int n, double maxDist) const {
+
+	std::vector<Eigen::Vector3d> points;
+
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+
+			double u = (n > 1) ? (2.0 * i) / (n - 1) - 1.0 : 0.0;
+			double v = (n > 1) ? (2.0 * j) / (n - 1) - 1.0 : 0.0;
+			Eigen::Vector3d dir = (forw + up * (v * tanAng) + right * (u * tanAng * aspectRatio)).normalized();
+
+			// Ray sphere intersection, nearest hit only
+			double b = eye.dot(dir);
+			double c = eye.squaredNorm() - RADIUS_EARTH_M * RADIUS_EARTH_M;
+			double disc = b * b - c;
+			if (disc < 0.0) {
+				continue;
+			}
+			double t = -b - sqrt(disc);
+			// maxDist is a depth, like the pixel size test it comes from, not a distance along the ray
+			if (t > 0.0 && t * dir.dot(forw) <= maxDist) {
+				points.push_back(eye + t * dir);
+			}
+		}
+	}
+	return points;
 }
\ No newline at end of file
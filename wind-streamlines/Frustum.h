@@ -15,7 +15,14 @@ public:
 	Frustum(const Camera& c, const RenderEngine& r);
 
 	bool pointInside(const Eigen::Vector3d& p) const;
+	bool pointInside(const Eigen::Vector3d& p, double maxDist) const;
 	bool overlap(const std::vector<Eigen::Vector3d>& points) const;
+	bool overlap(const std::vector<Eigen::Vector3d>& points, double maxDist) const;
+
+	double maxDistForPixelSize(double size, double pixels) const;
+	double minDepthOfSphere(double radius) const;
+	std::vector<Eigen::Vector3d> groundPoints(int n, double maxDist) const;
+	const Eigen::Vector3d& getEye() const { return eye; }
 
 private:
 	Eigen::Vector3d eye;
@@ -27,5 +34,6 @@ private:
 	double far;
 	double tanAng;
 	double aspectRatio;
+	double pixelHeight;
 };
 
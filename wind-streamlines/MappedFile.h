@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+
+
+// Read only memory mapping of a whole file. Pages are read in by the OS as they are touched
+class MappedFile {
+
+public:
+	MappedFile(const char* path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool isOpen() const { return data != nullptr; }
+	const char* getData() const { return data; }
+	size_t getSize() const { return size; }
+
+private:
+	const char* data;
+	size_t size;
+
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#endif
+};
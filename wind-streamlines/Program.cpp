@@ -50,20 +50,39 @@ void Program::start() {
 	//evc = new EarthViewController(*camera, *renderEngine, initialCameraDist);
 	//input = new InputHandler(*renderEngine, *evc, *this);
 
-	// Load coastline vector data and set up renderable for it
-	rapidjson::Document cl = ContentReadWrite::readJSON("./data/coastlines.json");
-	coastRender = ColourRenderable(cl);
+	// Load vector overlays in parallel. Only coastlines ship with the program, the others are optional
+	// Binary cache is used when it is up to date, otherwise source is parsed and cached for next time
+	const char* overlayPaths[NUM_OVERLAYS] = { "./data/coastlines.json", "./data/borders.json", "./data/lakes.json", "./data/firs.json" };
+	glm::u8vec3 overlayColours[NUM_OVERLAYS] = { glm::u8vec3(255, 255, 255), glm::u8vec3(170, 170, 170), glm::u8vec3(90, 150, 230), glm::u8vec3(230, 180, 60) };
+
+	// Only coastlines are required, the other layers are drawn if their files are there
+	std::vector<GeoJSONLayer> layers;
+	for (int i = 0; i < NUM_OVERLAYS; i++) {
+		layers.push_back({ overlayPaths[i], overlayColours[i], &overlayRenders[i], i > 0 });
+	}
+	ContentReadWrite::loadGeoJSONLayers(layers);
 
-	ContentReadWrite::loadOBJ("./data/sphere.obj", sphereRender);
+	glm::u8vec3 sphereColour(76, 76, 76);
+	if (!ContentReadWrite::readGeometry("./data/sphere.bin", "./data/sphere.obj", sphereColour, sphereRender)) {
+		if (ContentReadWrite::loadOBJ("./data/sphere.obj", sphereColour, sphereRender)) {
+			ContentReadWrite::writeGeometry("./data/sphere.bin", sphereColour, sphereRender);
+		}
+	}
 
-	coastRender.assignBuffers();
-	coastRender.setBufferData();
+	for (ColourRenderable& r : overlayRenders) {
+		if (r.size() > 0) {
+			r.assignBuffers();
+			r.setBufferData();
+			staticObjects.push_back(&r);
+		}
+	}
 	sphereRender.assignBuffers();
 	sphereRender.setBufferData();
+	staticObjects.push_back(&sphereRender);
 
 	// Load vector field
 	netCDF::NcFile file("./data/2017-09-05T12.nc", netCDF::NcFile::read);
-	field = SphericalVectorField(file);
+	field = SphericalVectorField(file, FieldSubset(), FieldLayout::Linear, SeedingEngine::maxCellM(SeedingEngine::maxSepScale));
 	seeder = new SeedingEngine(field);
 
 	// TODO work out multithreading
@@ -82,6 +101,7 @@ void Program::mainLoop() {
 	while (true) {
 		
 		window.renderSetup();
+		RenderEngine::beginFrame();
 		input.updateCursor();
 
 		// Process SDL events
@@ -104,12 +124,11 @@ void Program::mainLoop() {
 		// Render everything
 		ImGui::Render();
 		
-		objects = seeder->getLinesToRender(Frustum(camera, renderEngine), camera.getDist());
-		objects.push_back(&coastRender);
-		objects.push_back(&sphereRender);
+		objects = seeder->getLinesToRender(Frustum(camera, renderEngine));
+		objects.insert(objects.end(), staticObjects.begin(), staticObjects.end());
 		
 		renderEngine.render(objects, camera.getLookAt(), dTimeS.count());
-		swm.renderAll(*seeder, {&coastRender, &sphereRender}, dTimeS.count());
+		swm.renderAll(*seeder, staticObjects, dTimeS.count());
 
 		window.finalizeRender();
 	}
@@ -120,11 +139,14 @@ void Program::mainLoop() {
 // TODO cleanup steamline renders
 void Program::cleanup() {
 
-	coastRender.deleteBufferData();
+	for (ColourRenderable& r : overlayRenders) {
+		r.deleteBufferData();
+	}
 	sphereRender.deleteBufferData();
 	//streamlineRender.deleteBufferData();
 
 	delete seeder;
+	RenderEngine::releaseShared();
 
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
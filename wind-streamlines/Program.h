@@ -34,6 +34,7 @@ public:
 
 private:
 	static constexpr double initialCameraDist = RADIUS_EARTH_M * 3.0;
+	static constexpr int NUM_OVERLAYS = 4;
 
 	Window window;
 	RenderEngine renderEngine;
@@ -44,7 +45,8 @@ private:
 	SeedingEngine* seeder;
 
 	ColourRenderable sphereRender;
-	ColourRenderable coastRender;
+	ColourRenderable overlayRenders[NUM_OVERLAYS];
+	std::vector<Renderable*> staticObjects;
 
 	SphericalVectorField field;
 
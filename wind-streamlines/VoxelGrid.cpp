@@ -2,6 +2,8 @@
 
 #include "Conversions.h"
 
+#include <algorithm>
+
 
 // Create voxel grid for a size and seperation distance
 //
@@ -10,18 +12,86 @@
 VoxelGrid::VoxelGrid(double rad, double sepDist) :
 	rad(rad),
 	sepDist(sepDist),
+	cellSize(sepDist),
 	numCells((size_t)((rad * 2.0) / sepDist) + 1),
+	bounded(false),
+	parent(nullptr),
 	grid(numCells * numCells) {}
 
 
+// Create small grid for a lat long region that layers on top of a larger grid. Points are added to this grid only,
+// but are tested against both. Parent must outlive this grid and not change while it is used
+//
+// parent - grid with existing points
+// minLat - southern bound in rads
+// maxLat - northern bound in rads
+// minLng - western bound in rads [0, 2pi)
+// maxLng - eastern bound in rads [0, 2pi). Can be less than minLng if region wraps around
+VoxelGrid::VoxelGrid(const VoxelGrid& parent, double minLat, double maxLat, double minLng, double maxLng) :
+	rad(parent.rad),
+	sepDist(parent.sepDist),
+	cellSize(parent.cellSize),
+	numCells(parent.numCells),
+	parent(&parent) {
+
+	setBounds(minLat, maxLat, minLng, maxLng);
+}
+
+
+// Changes seperation distance used for testing points. Cells keep their size, so the distance can only shrink
+//
+// newSepDist - new seperation distance, clamped to the cell width
+void VoxelGrid::setSepDist(double newSepDist) {
+	sepDist = std::min(newSepDist, cellSize);
+}
+
+
+// Restrict the grid to a lat long region. Points outside the region always fail testPoint
+//
+// minLat - southern bound in rads
+// maxLat - northern bound in rads
+// minLng - western bound in rads [0, 2pi)
+// maxLng - eastern bound in rads [0, 2pi). Can be less than minLng if region wraps around
+void VoxelGrid::setBounds(double minLat, double maxLat, double minLng, double maxLng) {
+	bounded = true;
+	this->minLat = minLat;
+	this->maxLat = maxLat;
+	this->minLng = minLng;
+	this->maxLng = maxLng;
+}
+
+
+// Test if point is inside region of grid
+//
+// p - point to test in cartesian
+// return - true if grid is unbounded or point is inside bounds
+bool VoxelGrid::inBounds(const Eigen::Vector3d& p) const {
+
+	if (!bounded) {
+		return true;
+	}
+	Eigen::Vector2d latLng = cartToLatLng(p);
+
+	if (latLng.x() < minLat || latLng.x() > maxLat) {
+		return false;
+	}
+	if (minLng <= maxLng) {
+		return latLng.y() >= minLng && latLng.y() <= maxLng;
+	}
+	else {
+		return latLng.y() >= minLng || latLng.y() <= maxLng;
+	}
+}
+
+
 // Adds point to the grid
 //
 // p - point to add in cartesian
 void VoxelGrid::addPoint(const Eigen::Vector3d& p) {
 
-	size_t x = (size_t)((p.x() + rad) / sepDist);
-	size_t y = (size_t)((p.y() + rad) / sepDist);
-	size_t z = (size_t)((p.z() + rad) / sepDist);
+	size_t x = (size_t)((p.x() + rad) / cellSize);
+	size_t y = (size_t)((p.y() + rad) / cellSize);
+	size_t z = (size_t)((p.z() + rad) / cellSize);
 
 	grid[indexToOffset(x, y, z)].push_back(p);
 }
@@ -30,12 +100,20 @@ void VoxelGrid::addPoint(const Eigen::Vector3d& p) {
 // Test if point is within seperation distance of other points in grid
 //
 // p - point to test in cartesian
-// return - false if point is within sepDist of another point, otherwise true
+// return - false if point is within sepDist of another point or outside bounds, otherwise true
 bool VoxelGrid::testPoint(const Eigen::Vector3d& p) const {
 
-	size_t xM1 = (size_t)((p.x() + rad) / sepDist) - 1;
-	size_t yM1 = (size_t)((p.y() + rad) / sepDist) - 1;
-	size_t zM1 = (size_t)((p.z() + rad) / sepDist) - 1;
+	if (!inBounds(p)) {
+		return false;
+	}
+	if (parent != nullptr && !parent->testPoint(p)) {
+		return false;
+	}
+	double pLen = p.norm();
+
+	size_t xM1 = (size_t)((p.x() + rad) / cellSize) - 1;
+	size_t yM1 = (size_t)((p.y() + rad) / cellSize) - 1;
+	size_t zM1 = (size_t)((p.z() + rad) / cellSize) - 1;
 
 	for (size_t xI = 0; xI < 3; xI++) {
 		for (size_t yI = 0; yI < 3; yI++) {
@@ -51,11 +129,10 @@ bool VoxelGrid::testPoint(const Eigen::Vector3d& p) const {
 					continue;
 				}
 
-				if (grid.find(indexToOffset(x, y, z)) != grid.end()) {
-					const auto cell = grid.at(indexToOffset(x, y, z));
-					for (const Eigen::Vector3d& t : cell) {
+				auto cell = grid.find(indexToOffset(x, y, z));
+				if (cell != grid.end()) {
+					for (const Eigen::Vector3d& t : cell->second) {
 
-						double pLen = p.norm();
 						double tLen = t.norm();
 
 						double height = std::min(pLen, tLen);
@@ -11,6 +11,11 @@ class VoxelGrid {
 
 public:
 	VoxelGrid(double rad, double sepDist);
+	VoxelGrid(const VoxelGrid& parent, double minLat, double maxLat, double minLng, double maxLng);
+
+	void setSepDist(double newSepDist);
+	void setBounds(double minLat, double maxLat, double minLng, double maxLng);
+	bool inBounds(const Eigen::Vector3d& p) const;
 
 	void addPoint(const Eigen::Vector3d& p);
 	bool testPoint(const Eigen::Vector3d& p) const;
@@ -20,8 +25,15 @@ public:
 private:
 	double rad;
 	double sepDist;
+	double cellSize;
 	size_t numCells;
 
+	bool bounded;
+	double minLat, maxLat;
+	double minLng, maxLng;
+
+	const VoxelGrid* parent;
+
 	std::unordered_map<size_t, std::vector<Eigen::Vector3d>> grid;
 };
 
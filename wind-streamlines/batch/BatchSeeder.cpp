@@ -0,0 +1,457 @@
+#include "BatchSeeder.h"
+
+#include "BoundedQueue.h"
+#include "ContentReadWrite.h"
+#include "streamlines/SeedingEngine.h"
+#include "streamlines/SphericalVectorField.h"
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+#include <netcdf>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+
+// Create seeder for a list of slices
+//
+// slices - paths of NetCDF files, one time slice each
+// outDir - directory to write output to
+// numLevels - number of levels to seed
+// sepScale - multiplier for seperation distance of all levels
+// rank - index of this process
+// size - total number of processes
+// seedThreads - number of slices seeded at once by this process
+// prefetch - number of loaded slices that can wait for seeding
+// subset - region, levels, and decimation of each slice to load
+// cacheBytes - if not 0 slices are read on demand through a brick cache of this size instead of loaded whole
+// layout - order of points in memory of slices that are loaded whole
+// runId - name of this run, shared by all ranks, so rank 0 can tell their completion markers from an earlier run's
+// waitS - how long rank 0 waits for the other ranks after finishing its own slices, in seconds
+BatchSeeder::BatchSeeder(const std::vector<std::string>& slices, const std::string& outDir, int numLevels, float sepScale,
+                         int rank, int size, int seedThreads, int prefetch, const FieldSubset& subset,
+                         size_t cacheBytes, FieldLayout layout, const std::string& runId, int waitS) :
+	slices(slices),
+	outDir(outDir),
+	numLevels(numLevels),
+	sepScale(sepScale),
+	rank(rank),
+	size(size),
+	seedThreads(std::max(seedThreads, 1)),
+	prefetch(std::max(prefetch, 1)),
+	subset(subset),
+	cacheBytes(cacheBytes),
+	layout(layout),
+	runId(runId),
+	waitS(waitS) {}
+
+
+// Seeds this rank's share of the slices and collects results on rank 0
+//
+// return - exit code
+int BatchSeeder::run() {
+
+	std::filesystem::create_directories(outDir);
+
+#ifdef USE_MPI
+	if (size > 1 && rank == 0) {
+		return collectSlices();
+	}
+#endif
+
+	std::vector<size_t> mine = rankSlices();
+	BoundedQueue<std::pair<size_t, std::unique_ptr<SphericalVectorField>>> fields(prefetch);
+	BoundedQueue<std::pair<size_t, std::vector<char>>> results(prefetch);
+
+	// Reader stage. Without a brick cache only this thread touches NetCDF. With one (cacheBytes > 0) it only opens
+	// slices and the seeder threads read bricks through NetCDF as lines reach them, all under netCDFMutex. A slice
+	// that fails to load is passed on without a field so the later stages report it and the queues still close
+	std::thread reader([&]() {
+		for (size_t i : mine) {
+			std::unique_ptr<SphericalVectorField> field;
+			try {
+				field = loadSlice(i);
+			}
+			catch (const std::exception& e) {
+				std::cerr << "Rank " << rank << " could not load " << slices[i] << ": " << e.what() << std::endl;
+			}
+			fields.push(std::make_pair(i, std::move(field)));
+		}
+		fields.close();
+	});
+
+	// Seeding stage. Last seeder to finish closes the results
+	std::atomic<int> seedersLeft(seedThreads);
+	std::vector<std::thread> seeders;
+	for (int t = 0; t < seedThreads; t++) {
+		seeders.emplace_back([&]() {
+			while (std::optional<std::pair<size_t, std::unique_ptr<SphericalVectorField>>> f = fields.pop()) {
+				std::vector<char> data;
+				if (f->second) {
+					try {
+						data = seedSlice(*f->second);
+					}
+					catch (const std::exception& e) {
+						std::cerr << "Rank " << rank << " could not seed " << slices[f->first] << ": " << e.what() << std::endl;
+					}
+				}
+				results.push(std::make_pair(f->first, std::move(data)));
+			}
+			if (--seedersLeft == 0) {
+				results.close();
+			}
+		});
+	}
+
+	// Output stage on this thread, so MPI is only called from the main thread. Keeps draining after a failure, a
+	// failed slice arrives with no data
+	bool ok = true;
+	while (std::optional<std::pair<size_t, std::vector<char>>> r = results.pop()) {
+		ok = outputSlice(r->first, r->second) && ok;
+	}
+
+	reader.join();
+	for (std::thread& t : seeders) {
+		t.join();
+	}
+
+#ifdef USE_MPI
+	if (size > 1) {
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+#endif
+
+	// Without MPI every rank writes its own output and rank 0 waits for the others. Other ranks report failures
+	// too so rank 0 does not wait for output that will never come
+	if (rank != 0) {
+		return (writeMarker(ok) && ok) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (!ok || (size > 1 && !waitForRanks())) {
+		return EXIT_FAILURE;
+	}
+	return writeManifest() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Indices of slices this rank seeds. With MPI rank 0 coordinates so slices are split between the other ranks
+//
+// return - list of slice indices
+std::vector<size_t> BatchSeeder::rankSlices() const {
+
+	size_t first = rank;
+	size_t stride = size;
+
+#ifdef USE_MPI
+	if (size > 1) {
+		first = rank - 1;
+		stride = size - 1;
+	}
+#endif
+
+	std::vector<size_t> mine;
+	for (size_t i = first; i < slices.size(); i += stride) {
+		mine.push_back(i);
+	}
+	return mine;
+}
+
+
+// Loads and decodes one slice
+//
+// i - index of slice
+// return - vector field of slice
+std::unique_ptr<SphericalVectorField> BatchSeeder::loadSlice(size_t i) const {
+
+	std::cout << "Rank " << rank << " loading " << slices[i] << std::endl;
+
+	if (cacheBytes > 0) {
+		return std::make_unique<SphericalVectorField>(slices[i], subset, cacheBytes);
+	}
+	netCDF::NcFile file(slices[i], netCDF::NcFile::read);
+	return std::make_unique<SphericalVectorField>(file, subset, layout, SeedingEngine::maxCellM(sepScale));
+}
+
+
+// Seeds one slice
+//
+// field - vector field of slice
+// return - lines of all levels packed in the binary streamline format
+std::vector<char> BatchSeeder::seedSlice(SphericalVectorField& field) const {
+
+	SeedingEngine seeder(field, true);
+	seeder.setSeedingParams(numLevels, sepScale);
+	seeder.seed();
+
+	if (cacheBytes > 0) {
+		std::cout << "Rank " << rank << " seeded with " << field.residentBricks() << " bricks in memory" << std::endl;
+	}
+	return ContentReadWrite::packStreamlines(seeder.getStreamlines());
+}
+
+
+// Writes a finished slice, or sends it to rank 0 with MPI. A failed slice is still sent, empty, so rank 0 does not
+// wait for it
+//
+// i - index of slice
+// data - packed lines of slice, empty if loading or seeding failed
+// return - true if successful
+bool BatchSeeder::outputSlice(size_t i, const std::vector<char>& data) const {
+
+#ifdef USE_MPI
+	if (size > 1) {
+		return MPI_Send(data.data(), (int)data.size(), MPI_CHAR, 0, (int)i, MPI_COMM_WORLD) == MPI_SUCCESS &&
+		       !data.empty();
+	}
+#endif
+
+	if (data.empty()) {
+		return false;
+	}
+	std::cout << "Rank " << rank << " writing " << slicePath(i) << std::endl;
+	return ContentReadWrite::writeBinary(slicePath(i).c_str(), data);
+}
+
+
+// Receives slices from workers as they finish them and writes them. Slice index is the message tag, an empty
+// message is a slice that failed. Only used by rank 0 with MPI
+//
+// return - exit code
+int BatchSeeder::collectSlices() const {
+
+	bool ok = true;
+
+#ifdef USE_MPI
+	for (size_t received = 0; received < slices.size(); received++) {
+
+		MPI_Status status;
+		MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+
+		int count;
+		MPI_Get_count(&status, MPI_CHAR, &count);
+		std::vector<char> data(count);
+		MPI_Recv(data.data(), count, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+		if (data.empty()) {
+			std::cerr << "Slice " << status.MPI_TAG << " failed on rank " << status.MPI_SOURCE << std::endl;
+			ok = false;
+			continue;
+		}
+		ok = ContentReadWrite::writeBinary(slicePath(status.MPI_TAG).c_str(), data) && ok;
+		std::cout << "Slice " << status.MPI_TAG << " from rank " << status.MPI_SOURCE << std::endl;
+	}
+#endif
+	if (!ok) {
+		return EXIT_FAILURE;
+	}
+	return writeManifest() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Output path of a slice. Named after the slice's file so output sorts the same way as input
+//
+// i - index of slice
+// return - path of output file
+std::string BatchSeeder::slicePath(size_t i) const {
+	std::filesystem::path name = std::filesystem::path(slices[i]).stem();
+	return (std::filesystem::path(outDir) / name).string() + ".wstl";
+}
+
+
+// Path of the completion marker of a rank
+//
+// r - rank
+// return - path of marker file
+std::string BatchSeeder::markerPath(int r) const {
+	return (std::filesystem::path(outDir) / ("rank" + std::to_string(r) + ".done")).string();
+}
+
+
+// Writes this rank's completion marker once all its slices are written. Holds the run id and whether every slice
+// succeeded, so markers and output left by an earlier run are not mistaken for this one's
+//
+// ok - true if every slice of this rank was written
+// return - true if marker was written
+bool BatchSeeder::writeMarker(bool ok) const {
+	std::string text = runId + (ok ? " ok" : " failed");
+	return ContentReadWrite::writeBinary(markerPath(rank).c_str(), std::vector<char>(text.begin(), text.end()));
+}
+
+
+// Waits until every other rank has written its completion marker for this run. Other ranks write to the same
+// directory without MPI
+//
+// return - true if all ranks finished successfully, false if one failed or waitS passed first
+bool BatchSeeder::waitForRanks() const {
+
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(waitS);
+
+	for (int r = 1; r < size; r++) {
+		while (true) {
+			std::string id, status;
+			std::ifstream marker(markerPath(r));
+			if (marker >> id >> status && id == runId) {
+				if (status != "ok") {
+					std::cerr << "Rank " << r << " failed, no manifest written" << std::endl;
+					return false;
+				}
+				break;
+			}
+			if (std::chrono::steady_clock::now() > deadline) {
+				std::cerr << "Timed out waiting for rank " << r << ", no manifest written" << std::endl;
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+	}
+	return true;
+}
+
+
+// Writes list of slices and their output files in slice order
+//
+// return - true if manifest was written
+bool BatchSeeder::writeManifest() const {
+
+	std::ofstream file((std::filesystem::path(outDir) / "manifest.txt").string());
+	if (!file.is_open()) {
+		std::cout << "Could not write manifest" << std::endl;
+		return false;
+	}
+	for (size_t i = 0; i < slices.size(); i++) {
+		file << slices[i] << " " << slicePath(i) << "\n";
+	}
+	return true;
+}
+
+
+// Parses a range given as min:max. Numbers that do not parse throw like std::stod
+//
+// s - range string
+// min - minimum out
+// max - maximum out
+// mayWrap - if true min can be above max, for longitude ranges that wrap past 0
+// return - false if s is not a range
+bool BatchSeeder::parseRange(const std::string& s, double& min, double& max, bool mayWrap) {
+	size_t colon = s.find(':');
+	if (colon == std::string::npos) {
+		std::cerr << "Expected min:max, got " << s << std::endl;
+		return false;
+	}
+	min = std::stod(s.substr(0, colon));
+	max = std::stod(s.substr(colon + 1));
+	if (!mayWrap && min > max) {
+		std::cerr << "Expected min <= max, got " << s << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+// Entry point for batch mode. Usage:
+// --batch <file listing one slice path per line> --out <dir> [--levels n] [--sep-scale s]
+//         [--rank r --size n --run id] [--wait-s n] [--seed-threads n] [--prefetch n] [--lat min:max]
+//         [--lng min:max] [--pressure min:max] [--stride n] [--cache-mb n] [--layout linear|bricked]
+// Only a longitude range may wrap past 0, e.g. --lng 350:10
+// Rank and size come from MPI instead when built with USE_MPI. Without MPI all ranks of a run need the same run id
+//
+// argc - number of arguments
+// argv - arguments
+// return - exit code
+int BatchSeeder::main(int argc, char* argv[]) {
+
+	std::string listPath, outDir = "./out";
+	int numLevels = 5;
+	float sepScale = 1.f;
+	int rank = 0, size = 1;
+	int seedThreads = 1, prefetch = 1;
+	FieldSubset subset;
+	size_t cacheBytes = 0;
+	FieldLayout layout = FieldLayout::Linear;
+	std::string runId;
+	int waitS = 3600;
+
+	bool validRange = true;
+	for (int i = 1; i < argc; i += 2) {
+		std::string arg = argv[i];
+		if (i + 1 == argc) {
+			std::cerr << "Missing value for " << arg << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		// Number conversions throw invalid_argument or out_of_range, both logic errors
+		try {
+			if (arg == "--batch") listPath = argv[i + 1];
+			else if (arg == "--out") outDir = argv[i + 1];
+			else if (arg == "--levels") numLevels = std::stoi(argv[i + 1]);
+			else if (arg == "--sep-scale") sepScale = std::stof(argv[i + 1]);
+			else if (arg == "--rank") rank = std::stoi(argv[i + 1]);
+			else if (arg == "--size") size = std::stoi(argv[i + 1]);
+			else if (arg == "--run") runId = argv[i + 1];
+			else if (arg == "--wait-s") waitS = std::stoi(argv[i + 1]);
+			else if (arg == "--seed-threads") seedThreads = std::stoi(argv[i + 1]);
+			else if (arg == "--prefetch") prefetch = std::stoi(argv[i + 1]);
+			else if (arg == "--lat") validRange = parseRange(argv[i + 1], subset.minLat, subset.maxLat);
+			else if (arg == "--lng") validRange = parseRange(argv[i + 1], subset.minLng, subset.maxLng, true);
+			else if (arg == "--pressure") validRange = parseRange(argv[i + 1], subset.minLevel, subset.maxLevel);
+			else if (arg == "--stride") subset.stride = std::stoul(argv[i + 1]);
+			else if (arg == "--cache-mb") cacheBytes = std::stoul(argv[i + 1]) << 20;
+			else if (arg == "--layout") layout = (std::string(argv[i + 1]) == "bricked") ? FieldLayout::Bricked : FieldLayout::Linear;
+			else {
+				std::cerr << "Unknown argument " << arg << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		catch (const std::logic_error&) {
+			std::cerr << "Bad value for " << arg << ": " << argv[i + 1] << std::endl;
+			return EXIT_FAILURE;
+		}
+		if (!validRange) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<std::string> slices;
+	std::ifstream list(listPath);
+	for (std::string line; std::getline(list, line);) {
+		if (!line.empty()) {
+			slices.push_back(line);
+		}
+	}
+	if (slices.empty()) {
+		std::cerr << "No slices listed in " << listPath << std::endl;
+		return EXIT_FAILURE;
+	}
+
+#ifdef USE_MPI
+	// Worker threads never call MPI
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+#else
+	if (size < 1 || rank < 0 || rank >= size) {
+		std::cerr << "Need 0 <= rank < size" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (size > 1 && (runId.empty() || runId.find_first_of(" \t\r\n") != std::string::npos)) {
+		std::cerr << "Need a --run id without spaces with more than one rank" << std::endl;
+		return EXIT_FAILURE;
+	}
+#endif
+
+	int result = BatchSeeder(slices, outDir, numLevels, sepScale, rank, size, seedThreads, prefetch, subset, cacheBytes, layout,
+	                         runId, waitS).run();
+
+#ifdef USE_MPI
+	MPI_Finalize();
+#endif
+	return result;
+}
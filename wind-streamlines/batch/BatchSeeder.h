@@ -0,0 +1,58 @@
+#pragma once
+
+#include "streamlines/SphericalVectorField.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Seeds a list of time slices without a window and writes the lines of each slice in the binary streamline format.
+// Slices are split between ranks by index so several processes can work through one list. Without MPI each rank is
+// a separate process started with --rank, --size and --run, all ranks write to a shared output directory, and each
+// rank writes a completion marker tagged with the run id. Rank 0 writes the manifest once every other rank's marker
+// for this run appears, and gives up after a timeout. With USE_MPI defined rank 0 only coordinates: workers send
+// packed slices to it and it writes all output, so nodes do not need a shared file system
+//
+// Each rank runs a pipeline so loading, seeding and output overlap. A reader thread loads the next slices, a pool of
+// seeding threads seeds them, and the calling thread writes or sends results. Stages are connected by bounded queues
+// which limit how many decoded fields are held at once
+class BatchSeeder {
+
+public:
+	BatchSeeder(const std::vector<std::string>& slices, const std::string& outDir, int numLevels, float sepScale,
+	            int rank, int size, int seedThreads, int prefetch, const FieldSubset& subset, size_t cacheBytes,
+	            FieldLayout layout, const std::string& runId, int waitS);
+
+	int run();
+
+	static int main(int argc, char* argv[]);
+
+private:
+	std::vector<std::string> slices;
+	std::string outDir;
+	int numLevels;
+	float sepScale;
+	int rank;
+	int size;
+	int seedThreads;
+	int prefetch;
+	FieldSubset subset;
+	size_t cacheBytes;
+	FieldLayout layout;
+	std::string runId;
+	int waitS;
+
+	std::vector<size_t> rankSlices() const;
+	std::unique_ptr<SphericalVectorField> loadSlice(size_t i) const;
+	std::vector<char> seedSlice(SphericalVectorField& field) const;
+	bool outputSlice(size_t i, const std::vector<char>& data) const;
+	int collectSlices() const;
+	std::string slicePath(size_t i) const;
+	bool writeManifest() const;
+	std::string markerPath(int r) const;
+	bool writeMarker(bool ok) const;
+	bool waitForRanks() const;
+
+	static bool parseRange(const std::string& s, double& min, double& max, bool mayWrap = false);
+};
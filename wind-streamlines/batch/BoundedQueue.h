@@ -0,0 +1,58 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+
+// Thread safe FIFO queue with a maximum size, for connecting pipeline stages. Producers block while the queue is full
+// so a fast stage can not run arbitrarily far ahead of a slow one. Once closed, consumers drain what is left and then
+// get nothing
+template<typename T>
+class BoundedQueue {
+
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+	// Adds item to back of queue, waiting for space if needed
+	//
+	// item - item to add
+	void push(T item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this]() { return items.size() < capacity; });
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+	}
+
+	// Removes item from front of queue, waiting for one if needed
+	//
+	// return - item, or nothing if queue is closed and empty
+	std::optional<T> pop() {
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this]() { return !items.empty() || closed; });
+		if (items.empty()) {
+			return std::nullopt;
+		}
+		T item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return item;
+	}
+
+	// Signals that no more items will be pushed
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		notEmpty.notify_all();
+	}
+
+private:
+	size_t capacity;
+	bool closed;
+
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+};
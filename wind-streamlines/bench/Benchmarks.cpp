@@ -0,0 +1,401 @@
+#include "Benchmarks.h"
+
+#include "ContentReadWrite.h"
+#include "Conversions.h"
+#include "streamlines/SeedingEngine.h"
+#include "streamlines/SphericalVectorField.h"
+#include "VoxelGrid.h"
+
+#include <netcdf>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// Times a function
+//
+// f - function to time
+// return - elapsed seconds
+template<typename F>
+static double timeS(F f) {
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	f();
+	std::chrono::duration<double> dTimeS = std::chrono::steady_clock::now() - t0;
+	return dTimeS.count();
+}
+
+
+// Compares lookup table conversions against the exact formulas, per value and in batches, and reports the largest
+// error over the tested range. With a slice, also times seeding the slice end to end. Build once as is and once
+// with EXACT_CONVERSIONS defined to get the end to end speedup of the tables
+//
+// slicePath - NetCDF slice to seed, or empty to skip
+// numLevels - number of levels to seed
+// return - exit code
+static int conversions(const std::string& slicePath, int numLevels) {
+
+	const size_t n = 1 << 22;
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> mbDist(1.0, 1000.0);
+	std::uniform_real_distribution<double> altDist(0.0, mbarsToAltExact(1.0));
+
+	std::vector<double> mb(n), alt(n), out(n), exact(n);
+	for (size_t i = 0; i < n; i++) {
+		mb[i] = mbDist(rng);
+		alt[i] = altDist(rng);
+	}
+
+	// Pressure to altitude
+	double tExact = timeS([&]() { for (size_t i = 0; i < n; i++) exact[i] = mbarsToAltExact(mb[i]); });
+	double tScalar = timeS([&]() { for (size_t i = 0; i < n; i++) out[i] = mbarsToAlt(mb[i]); });
+	double tBatch = timeS([&]() { mbarsToAlt(mb.data(), out.data(), n); });
+
+	double maxErr = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		maxErr = std::max(maxErr, std::abs(out[i] - exact[i]));
+	}
+	std::cout << "mbarsToAlt  exact " << 1e9 * tExact / n << " ns, table " << 1e9 * tScalar / n << " ns, batch "
+	          << 1e9 * tBatch / n << " ns, max error " << maxErr << " m" << std::endl;
+
+	// Altitude to pressure
+	tExact = timeS([&]() { for (size_t i = 0; i < n; i++) exact[i] = altToMBarsExact(alt[i]); });
+	tScalar = timeS([&]() { for (size_t i = 0; i < n; i++) out[i] = altToMBars(alt[i]); });
+	tBatch = timeS([&]() { altToMBars(alt.data(), out.data(), n); });
+
+	maxErr = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		maxErr = std::max(maxErr, std::abs(out[i] - exact[i]));
+	}
+	std::cout << "altToMBars  exact " << 1e9 * tExact / n << " ns, table " << 1e9 * tScalar / n << " ns, batch "
+	          << 1e9 * tBatch / n << " ns, max error " << maxErr << " mbars" << std::endl;
+
+	if (slicePath.empty()) {
+		return EXIT_SUCCESS;
+	}
+
+	netCDF::NcFile file(slicePath, netCDF::NcFile::read);
+	SphericalVectorField field(file, FieldSubset(), FieldLayout::Linear, SeedingEngine::maxCellM(1.f));
+
+	SeedingEngine seeder(field, true);
+	seeder.setSeedingParams(numLevels, 1.f);
+	double tSeed = timeS([&]() { seeder.seed(); });
+
+#ifdef EXACT_CONVERSIONS
+	const char* mode = "exact";
+#else
+	const char* mode = "table";
+#endif
+	std::cout << "Seeding " << numLevels << " levels with " << mode << " conversions took " << tSeed << " s" << std::endl;
+	return EXIT_SUCCESS;
+}
+
+
+// Integrates lines from random seeds on one thread and reports accepted RK steps per second. The voxel grid is
+// empty so lines only stop at the domain boundary or after maxDist, which keeps the work per seed comparable
+// between builds
+//
+// slicePath - NetCDF slice to integrate on
+// numSeeds - number of seeds
+// return - exit code
+static int integrator(const std::string& slicePath, int numSeeds) {
+
+	if (slicePath.empty()) {
+		std::cerr << "The integrator benchmark needs a slice" << std::endl;
+		return EXIT_FAILURE;
+	}
+	netCDF::NcFile file(slicePath, netCDF::NcFile::read);
+	SphericalVectorField field(file);
+	VoxelGrid vg(mbarsToAbs(1.0) + 100.0, 1000000.0);
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> latDist(-M_PI_2, M_PI_2);
+	std::uniform_real_distribution<double> lngDist(0.0, 2.0 * M_PI);
+	std::uniform_real_distribution<double> mbDist(1.0, 1000.0);
+
+	std::vector<Eigen::Vector3d> seeds;
+	while (seeds.size() < (size_t)numSeeds) {
+		Eigen::Vector3d seed(latDist(rng), lngDist(rng), mbDist(rng));
+		if (field.inDomain(seed)) {
+			seeds.push_back(seed);
+		}
+	}
+
+	size_t steps = 0;
+	double t = timeS([&]() {
+		for (const Eigen::Vector3d& seed : seeds) {
+			std::optional<Streamline> line = field.streamline(seed, 2000000.0, 1000.0, 10000.0, vg);
+			if (line) {
+				steps += line->size() - 1;
+			}
+		}
+	});
+	std::cout << numSeeds << " seeds, " << steps << " steps in " << t << " s, " << steps / t << " steps/s" << std::endl;
+	return EXIT_SUCCESS;
+}
+
+
+// Set associative cache with least recently used replacement, for counting the misses of a trace of addresses
+class CacheModel {
+
+public:
+	static const size_t LINE_BYTES = 64;
+
+	// Create empty cache
+	//
+	// bytes - capacity
+	// ways - lines per set
+	CacheModel(size_t bytes, size_t ways) :
+		ways(ways),
+		numSets(bytes / (LINE_BYTES * ways)),
+		lines(numSets * ways, ~(uintptr_t)0),
+		misses(0) {}
+
+	// Touches every line of a value
+	//
+	// p - address of value
+	// size - size of value in bytes
+	void access(const void* p, size_t size) {
+		for (uintptr_t line = (uintptr_t)p / LINE_BYTES; line <= ((uintptr_t)p + size - 1) / LINE_BYTES; line++) {
+			accessLine(line);
+		}
+	}
+
+	size_t getMisses() const { return misses; }
+
+private:
+	size_t ways;
+	size_t numSets;
+	std::vector<uintptr_t> lines;
+	size_t misses;
+
+	// Looks up a line in its set, most recently used first, and replaces the least recently used one on a miss
+	//
+	// line - address divided by line size
+	void accessLine(uintptr_t line) {
+		uintptr_t* set = &lines[(line % numSets) * ways];
+		for (size_t w = 0; w < ways; w++) {
+			if (set[w] == line) {
+				std::rotate(set, set + w, set + w + 1);
+				return;
+			}
+		}
+		misses++;
+		std::rotate(set, set + ways - 1, set + ways);
+		set[0] = line;
+	}
+};
+
+
+// Measures velocityAt for each memory layout, with positions spread at random and with positions that move through
+// the field in small steps like streamlines do. Reports time per evaluation, and cache misses per evaluation from
+// replaying the addresses of the 8 corners each evaluation reads through a model of a 32 KB L1 and a 1 MB L2 cache.
+// Only reads of field data are modelled
+//
+// slicePath - NetCDF slice to load
+// numEvals - number of evaluations per layout and pattern
+// return - exit code
+static int layout(const std::string& slicePath, size_t numEvals) {
+
+	if (slicePath.empty()) {
+		std::cerr << "The layout benchmark needs a slice" << std::endl;
+		return EXIT_FAILURE;
+	}
+	netCDF::NcFile file(slicePath, netCDF::NcFile::read);
+
+	// Positions as fractional (lat, long, level) indices, so the corners of each evaluation are known
+	std::vector<Eigen::Vector3d> random(numEvals), coherent(numEvals);
+	{
+		SphericalVectorField field(file);
+		Eigen::Vector3d maxIndex(field.getNumLats() - 1.01, field.getNumLongs() - 1.01, field.getNumLevels() - 1.01);
+
+		std::mt19937 rng(1);
+		std::uniform_real_distribution<double> u(0.0, 1.0);
+		for (Eigen::Vector3d& p : random) {
+			p = Eigen::Vector3d(u(rng), u(rng), u(rng)).cwiseProduct(maxIndex);
+		}
+
+		// Lines of 1000 steps, each a fraction of a cell in a fixed direction, turning back at the edges
+		Eigen::Vector3d p, step;
+		for (size_t i = 0; i < numEvals; i++) {
+			if (i % 1000 == 0) {
+				p = Eigen::Vector3d(u(rng), u(rng), u(rng)).cwiseProduct(maxIndex);
+				step = Eigen::Vector3d(u(rng) - 0.5, u(rng) - 0.5, 0.1 * (u(rng) - 0.5));
+			}
+			for (int d = 0; d < 3; d++) {
+				if (p[d] + step[d] < 0.0 || p[d] + step[d] > maxIndex[d]) {
+					step[d] = -step[d];
+				}
+			}
+			p += step;
+			coherent[i] = p;
+		}
+	}
+
+	for (FieldLayout fieldLayout : { FieldLayout::Linear, FieldLayout::Bricked }) {
+
+		SphericalVectorField field(file, FieldSubset(), fieldLayout);
+		const char* layoutName = (fieldLayout == FieldLayout::Linear) ? "linear " : "bricked";
+
+		for (const std::vector<Eigen::Vector3d>* indices : { &random, &coherent }) {
+
+			// Spherical coordinates of each position, interpolated between the grid points around it
+			std::vector<Eigen::Vector3d> positions(numEvals);
+			for (size_t i = 0; i < numEvals; i++) {
+				Eigen::Vector3d f = (*indices)[i];
+				Eigen::Vector3d c0 = field.sphCoords((size_t)f.x(), (size_t)f.y(), (size_t)f.z());
+				Eigen::Vector3d c1 = field.sphCoords((size_t)f.x() + 1, (size_t)f.y() + 1, (size_t)f.z() + 1);
+				Eigen::Vector3d frac = f - f.array().floor().matrix();
+				positions[i] = c0 + frac.cwiseProduct(c1 - c0);
+			}
+
+			Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+			double t = timeS([&]() {
+				for (const Eigen::Vector3d& p : positions) {
+					sum += field.velocityAt(p);
+				}
+			});
+
+			CacheModel l1(32 << 10, 8), l2(1 << 20, 16);
+			for (const Eigen::Vector3d& f : *indices) {
+				for (int corner = 0; corner < 8; corner++) {
+					const Eigen::Vector3d& v = field((size_t)f.x() + (corner & 1), (size_t)f.y() + ((corner >> 1) & 1),
+					                                 (size_t)f.z() + (corner >> 2));
+					l1.access(&v, sizeof(v));
+					l2.access(&v, sizeof(v));
+				}
+			}
+
+			std::cout << layoutName << ((indices == &random) ? " random   " : " coherent ") << 1e9 * t / numEvals
+			          << " ns/eval, L1 misses " << (double)l1.getMisses() / numEvals << "/eval, L2 misses "
+			          << (double)l2.getMisses() / numEvals << "/eval (checksum " << sum.sum() << ")" << std::endl;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+
+// Seeds a slice one line at a time and again with tiled seeding, and compares the lengths of the lines. Fails if
+// tiled lines are more than 10% shorter on average, which means lines are being cut at tile edges
+//
+// slicePath - NetCDF slice to seed
+// numLevels - number of levels to seed
+// return - exit code
+static int tiling(const std::string& slicePath, int numLevels) {
+
+	if (slicePath.empty()) {
+		std::cerr << "The tiling benchmark needs a slice" << std::endl;
+		return EXIT_FAILURE;
+	}
+	netCDF::NcFile file(slicePath, netCDF::NcFile::read);
+	SphericalVectorField field(file, FieldSubset(), FieldLayout::Linear, SeedingEngine::maxCellM(1.f));
+
+	double meanLength[2];
+	for (int tiled = 0; tiled < 2; tiled++) {
+
+		SeedingEngine seeder(field, true);
+		seeder.setSeedingParams(numLevels, 1.f);
+		seeder.setTiledSeeding(tiled == 1);
+		double t = timeS([&]() { seeder.seed(); });
+
+		std::vector<double> lengths;
+		for (const std::vector<Streamline>& level : seeder.getStreamlines()) {
+			for (const Streamline& s : level) {
+				lengths.push_back(s.getTotalLength());
+			}
+		}
+		std::sort(lengths.begin(), lengths.end());
+		meanLength[tiled] = lengths.empty() ? 0.0 : std::accumulate(lengths.begin(), lengths.end(), 0.0) / lengths.size();
+		double median = lengths.empty() ? 0.0 : lengths[lengths.size() / 2];
+		double max = lengths.empty() ? 0.0 : lengths.back();
+
+		std::cout << (tiled ? "Tiled " : "Serial") << " " << lengths.size() << " lines in " << t << " s, length mean "
+		          << meanLength[tiled] / 1000.0 << " km, median " << median / 1000.0 << " km, max " << max / 1000.0
+		          << " km" << std::endl;
+	}
+
+	bool comparable = meanLength[1] >= 0.9 * meanLength[0];
+	std::cout << "Tiled mean length is " << 100.0 * meanLength[1] / meanLength[0] << "% of serial" << std::endl;
+	return comparable ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Seeds a slice, writes its lines in the binary streamline format, reads them back and checks that every level, point
+// and time survived unchanged. Reports the file size and the time to write and read it
+//
+// slicePath - NetCDF slice to seed
+// numLevels - number of levels to seed
+// return - exit code
+static int streamlineFile(const std::string& slicePath, int numLevels) {
+
+	if (slicePath.empty()) {
+		std::cerr << "The wstl benchmark needs a slice" << std::endl;
+		return EXIT_FAILURE;
+	}
+	netCDF::NcFile file(slicePath, netCDF::NcFile::read);
+	SphericalVectorField field(file, FieldSubset(), FieldLayout::Linear, SeedingEngine::maxCellM(1.f));
+
+	SeedingEngine seeder(field, true);
+	seeder.setSeedingParams(numLevels, 1.f);
+	seeder.seed();
+	const std::vector<std::vector<Streamline>>& written = seeder.getStreamlines();
+
+	std::string path = (std::filesystem::temp_directory_path() / "bench.wstl").string();
+	std::vector<std::vector<Streamline>> read;
+	bool ok = true;
+	double tWrite = timeS([&]() { ok = ContentReadWrite::writeStreamlines(path.c_str(), written); });
+	double tRead = timeS([&]() { ok = ok && ContentReadWrite::readStreamlines(path.c_str(), read); });
+	size_t bytes = ok ? (size_t)std::filesystem::file_size(path) : 0;
+	std::filesystem::remove(path);
+
+	ok = ok && read.size() == written.size();
+	for (size_t i = 0; ok && i < written.size(); i++) {
+		ok = read[i].size() == written[i].size();
+		for (size_t j = 0; ok && j < written[i].size(); j++) {
+			ok = read[i][j].getPoints() == written[i][j].getPoints() &&
+			     read[i][j].getLocalTimes() == written[i][j].getLocalTimes();
+		}
+	}
+
+	std::cout << bytes << " bytes, write " << tWrite << " s, read " << tRead << " s, round trip "
+	          << (ok ? "matches" : "differs") << std::endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Entry point for benchmarks. See Benchmarks.h for usage
+//
+// argc - number of arguments
+// argv - arguments
+// return - exit code
+int Benchmarks::main(int argc, char* argv[]) {
+
+	std::string name = (argc > 2) ? argv[2] : "";
+	std::string slicePath = (argc > 3) ? argv[3] : "";
+
+	if (name == "conversions") {
+		return conversions(slicePath, (argc > 4) ? std::stoi(argv[4]) : 3);
+	}
+	else if (name == "integrator") {
+		return integrator(slicePath, (argc > 4) ? std::stoi(argv[4]) : 2000);
+	}
+	else if (name == "layout") {
+		return layout(slicePath, (argc > 4) ? std::stoul(argv[4]) : 2000000);
+	}
+	else if (name == "tiling") {
+		return tiling(slicePath, (argc > 4) ? std::stoi(argv[4]) : 3);
+	}
+	else if (name == "wstl") {
+		return streamlineFile(slicePath, (argc > 4) ? std::stoi(argv[4]) : 3);
+	}
+	std::cerr << "Unknown benchmark " << name << std::endl;
+	return EXIT_FAILURE;
+}
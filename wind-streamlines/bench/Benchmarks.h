@@ -0,0 +1,14 @@
+#pragma once
+
+
+// Benchmarks for the integration hot path, run from the command line without a window. Usage:
+// --bench conversions [slice.nc] [levels]
+// --bench integrator slice.nc [seeds]
+// --bench layout slice.nc [evaluations]
+// --bench tiling slice.nc [levels]
+// --bench wstl slice.nc [levels]
+// Each prints its measurements to stdout. Timings depend on the machine, compare runs made on the same one
+namespace Benchmarks {
+
+	int main(int argc, char* argv[]);
+};
@@ -0,0 +1,68 @@
+#include "Ramp.h"
+#include "Utils.h"
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+namespace ColorSpace {
+	// Linear [0, 1] to 8-bit sRGB. Spacing keeps the error under 0.2 of a step at the steep low end of the curve
+	const size_t LabRamp::gammaTableSize = 16384;
+
+	static const std::vector<unsigned char>& GammaTable() {
+		static const std::vector<unsigned char> table = [] {
+			std::vector<unsigned char> t(LabRamp::gammaTableSize);
+			for (size_t i = 0; i < t.size(); i++) {
+				double c = (double)i / (t.size() - 1);
+				c = (c > 0.0031308) ? (1.055*pow(c, 1 / 2.4) - 0.055) : (12.92*c);
+				t[i] = (unsigned char)(c * 255.0 + 0.5);
+			}
+			return t;
+		}();
+		return table;
+	}
+
+	static inline unsigned char Encode(const unsigned char *table, double c) {
+		c = std::min(std::max(c, 0.0), 1.0);
+		return table[(size_t)(c * (LabRamp::gammaTableSize - 1) + 0.5)];
+	}
+
+	// Same maths as LabConverter::ToColor and XyzConverter::ToColor fused into one loop without virtual calls.
+	// Lab to XYZ only needs cubes and sRGB encoding uses the lookup table
+	void LabRamp::ToRgb8(const Lab *items, size_t count, unsigned char *out) {
+		const unsigned char *table = GammaTable().data();
+
+		for (size_t i = 0; i < count; i++) {
+			double y = (items[i].l + 16.0) / 116.0;
+			double x = items[i].a / 500.0 + y;
+			double z = y - items[i].b / 200.0;
+
+			double x3 = POW3(x);
+			double y3 = POW3(y);
+			double z3 = POW3(z);
+
+			x = ((x3 > 0.008856) ? x3 : ((x - 16.0 / 116.0) / 7.787)) * 0.95047;
+			y = ((y3 > 0.008856) ? y3 : ((y - 16.0 / 116.0) / 7.787));
+			z = ((z3 > 0.008856) ? z3 : ((z - 16.0 / 116.0) / 7.787)) * 1.08883;
+
+			out[3 * i + 0] = Encode(table, x * 3.2404542 + y * -1.5371385 + z * -0.4985314);
+			out[3 * i + 1] = Encode(table, x * -0.9692660 + y * 1.8760108 + z * 0.0415560);
+			out[3 * i + 2] = Encode(table, x * 0.0556434 + y * -0.2040259 + z * 1.0572252);
+		}
+	}
+
+	// Dense ramp of size colours from low to high interpolated in Lab. Only the two end points use the slow path
+	void LabRamp::Build(Rgb *low, Rgb *high, size_t size, unsigned char *out) {
+		Lab lowLab, highLab;
+		lowLab.Initialize(low);
+		highLab.Initialize(high);
+
+		std::vector<Lab> labs(size);
+		for (size_t i = 0; i < size; i++) {
+			double n = (size > 1) ? (double)i / (size - 1) : 0.0;
+			labs[i].l = (1.0 - n) * lowLab.l + n * highLab.l;
+			labs[i].a = (1.0 - n) * lowLab.a + n * highLab.a;
+			labs[i].b = (1.0 - n) * lowLab.b + n * highLab.b;
+		}
+		ToRgb8(labs.data(), size, out);
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef RAMP_H
+#define RAMP_H
+
+#include "ColorSpace.h"
+#include <cstddef>
+
+namespace ColorSpace {
+	// Batch conversions that avoid the per colour virtual calls and pow of the IColorSpace interface.
+	// Rgb values use the same 0-255 range as the rest of the library, output is packed 8-bit rgb triples
+	struct LabRamp {
+		static void ToRgb8(const Lab *items, size_t count, unsigned char *out);
+		static void Build(Rgb *low, Rgb *high, size_t size, unsigned char *out);
+
+		static const size_t gammaTableSize;
+	};
+}
+
+#endif // RAMP_H
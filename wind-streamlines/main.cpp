@@ -1,7 +1,22 @@
 #include "Program.h"
 
+#include "batch/BatchSeeder.h"
+#include "bench/Benchmarks.h"
+
+#include <cstring>
+
 int main(int argc, char* argv[]) {
 
+	// Seed time slices without a window
+	if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+		return BatchSeeder::main(argc, argv);
+	}
+
+	// Measure hot paths without a window
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+		return Benchmarks::main(argc, argv);
+	}
+
 	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
 		std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
 		system("pause");
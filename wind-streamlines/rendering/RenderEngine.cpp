@@ -6,15 +6,24 @@
 #include "Conversions.h"
 #include "Renderable.h"
 #include "ShaderTools.h"
+#include "UploadRing.h"
 #include "Window.h"
 
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <imgui.h>
 
+#include <algorithm>
 #include <iostream>
 
 
+// Colour ramp is shared by all engines since they share a context
+GLuint RenderEngine::colourRampTexture = 0;
+
+// Upload ring is also shared by all engines. Created by the first engine
+UploadRing* RenderEngine::uploadRing = nullptr;
+
+
 // Dear ImGUI window. Allows chaning render parameters
 void RenderEngine::ImGui() {
 	if (ImGui::CollapsingHeader("Render params")) {
@@ -55,13 +64,31 @@ RenderEngine::RenderEngine(const Window& window, int x, int y, int width, int he
 	diffuse(true),
 	lineWidth(1.f),
 	outlineWidth(1.f),
-	scaleFactor(10.f) {
+	scaleFactor(10.f),
+	oitFramebuffer(0),
+	oitSamples(1) {
 
 	// Compile shaders
 	// TODO this could be static - does not need to be done for each engine
 	mainProgram = ShaderTools::compileShaders("./shaders/main.vert", "./shaders/main.frag");
 	streamlineProgram = ShaderTools::compileShaders("./shaders/streamline.vert", "./shaders/streamline.frag");
 	streamlineProgram2 = ShaderTools::compileShaders("./shaders/streamline2.vert", "./shaders/streamline2.frag");
+	compositeProgram = ShaderTools::compileShaders("./shaders/composite.vert", "./shaders/composite.frag");
+
+	// Per frame uniforms are shared by all programs through a uniform buffer at binding point 0
+	glGenBuffers(1, &frameUniformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// Full screen composite generates its own vertices but core profile still needs a VAO bound
+	glGenVertexArrays(1, &emptyVAO);
+	createOITBuffers();
+
+	if (uploadRing == nullptr) {
+		uploadRing = new UploadRing(uploadSegmentSize, uploadSegments);
+		Renderable::setUploadRing(uploadRing);
+	}
 
 	updatePlanes(cameraDist);
 
@@ -89,6 +116,20 @@ RenderEngine::RenderEngine(const Window& window, double cameraDist) :
 	RenderEngine(window, 0, 0, window.getWidth(), window.getHeight(), cameraDist) {}
 
 
+// Frees GL objects owned by this engine. Shared colour ramp and upload ring are left for the other engines
+RenderEngine::~RenderEngine() {
+
+	deleteOITBuffers();
+	glDeleteVertexArrays(1, &emptyVAO);
+	glDeleteBuffers(1, &frameUniformBuffer);
+
+	glDeleteProgram(mainProgram);
+	glDeleteProgram(streamlineProgram);
+	glDeleteProgram(streamlineProgram2);
+	glDeleteProgram(compositeProgram);
+}
+
+
 // Clears viewport and makes a 1 pixel black border around the viewport
 void RenderEngine::clearViewport() {
 
@@ -121,80 +162,200 @@ void RenderEngine::render(const std::vector<Renderable*>& objects, const glm::dm
 		totalTime = fmod(totalTime, timeRepeat);
 	}
 
-	// Two passes are used when lines require an outline
-	int numPasses = (outlineWidth > lineWidth) ? 2 : 1;
-	for (int pass = 1; pass <= numPasses; pass++) {
+	setFrameUniforms(view);
 
-		if (pass == 1) {
-			glLineWidth(lineWidth);
-		}
-		else {
-			glLineWidth(outlineWidth);
-		}
+	// Opaque Earth reference
+	glLineWidth(lineWidth);
+	renderObjects(objects, Shader::DEFAULT, mainProgram);
+
+	// Outlines are all the same colour so regular blending is order independent. Drawn under the lines
+	if (outlineWidth > lineWidth) {
+		glDepthMask(GL_FALSE);
+		glLineWidth(outlineWidth);
+		renderObjects(objects, Shader::STREAMLINE, streamlineProgram2);
+		glLineWidth(lineWidth);
+		glDepthMask(GL_TRUE);
+	}
+
+	// Weighted blended order independent transparency for streamlines
+	// "Weighted Blended Order-Independent Transparency" McGuire and Bavoil 2013
+	GLfloat zero[] = {0.f, 0.f, 0.f, 0.f};
+	GLfloat one[] = {1.f, 1.f, 1.f, 1.f};
+
+	glBindFramebuffer(GL_FRAMEBUFFER, oitFramebuffer);
+	glViewport(0, 0, width, height);
+	glClearBufferfv(GL_COLOR, 0, zero);
+	glClearBufferfv(GL_COLOR, 1, one);
+	glClearBufferfv(GL_DEPTH, 0, one);
+
+	// Depth only pass of Earth reference so lines behind it are hidden
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	renderObjects(objects, Shader::DEFAULT, mainProgram);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	// Accumulate weighted colour and product of (1 - alpha)
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_1D, colourRampTexture);
+	glDepthMask(GL_FALSE);
+	glBlendFunci(0, GL_ONE, GL_ONE);
+	glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+	renderObjects(objects, Shader::STREAMLINE, streamlineProgram);
+	glDepthMask(GL_TRUE);
+
+	// Composite accumulated lines over the Earth reference
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(x, y, width, height);
+	glDisable(GL_DEPTH_TEST);
+	glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+
+	glUseProgram(compositeProgram);
+	glUniform1i(0, oitSamples);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, accumTexture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, revealTexture);
+	glBindVertexArray(emptyVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+
+	// Back to default state
+	glActiveTexture(GL_TEXTURE0);
+	glEnable(GL_DEPTH_TEST);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
 
-		// Reverse order so that Earth reference is drawn first
-		for (size_t i = objects.size(); i >= 1; i--) {
 
-			Renderable* r = objects[i - 1];
-		
-			GLuint program;
-			if (r->getVAO() == -1) {
-				r->assignBuffers();
-				r->setBufferData();
-			}
-			glBindVertexArray(r->getVAO());
+// Render all objects that use the provided shader type with the provided program
+//
+// objects - list of renderables to render
+// type - only objects with this shader type are rendered
+// program - shader program to use
+void RenderEngine::renderObjects(const std::vector<Renderable*>& objects, Shader type, GLuint program) {
 
-			// Get appropriate shader to use. If second pass and not a streamline, skip
-			if (r->getShaderType() == Shader::DEFAULT && pass == 1) {
-				program = mainProgram;
-			}
-			else if (r->getShaderType() == Shader::DEFAULT && pass == 2){
+	glUseProgram(program);
+
+	// Reverse order so that Earth reference is drawn first
+	for (size_t i = objects.size(); i >= 1; i--) {
+
+		Renderable* r = objects[i - 1];
+		if (r->getShaderType() != type) {
+			continue;
+		}
+
+		// Objects that do not fit in what is left of this frame's upload budget are drawn once they are uploaded
+		// in a later frame. An oversized object is still uploaded if it is the first one of the frame
+		if (r->getVAO() == -1) {
+			if (r->dataSize() > uploadRing->remaining() && uploadRing->remaining() < uploadSegmentSize) {
 				continue;
 			}
-			else if (pass == 1) {
-				program = streamlineProgram;
-			}
-			else {
-				program = streamlineProgram2;
-			}
-			glUseProgram(program);
-
-			// Get eye position from model view matrix
-			glm::dmat4 modelViewD = view;
-
-			glm::dmat4 inv = glm::inverse(modelViewD);
-			glm::dvec3 eyePos = inv[3];
-			glm::vec3 eyeHigh = eyePos;
-			glm::vec3 eyeLow = eyePos - (glm::dvec3)eyeHigh;
-			
-			// Set eye position to origin
-			modelViewD[3] = glm::dvec4(0.0, 0.0, 0.0, 1.0);
-			glm::mat4 modelView = modelViewD;
-
-			// Set uniforms
-			glUniform3fv(glGetUniformLocation(program, "eyeHigh"), 1, glm::value_ptr(eyeHigh));
-			glUniform3fv(glGetUniformLocation(program, "eyeLow"), 1, glm::value_ptr(eyeLow));
-
-			glUniformMatrix4fv(glGetUniformLocation(program, "modelView"), 1, GL_FALSE, glm::value_ptr(modelView));
-			glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr((glm::mat4)projection));
-
-			glUniform1f(glGetUniformLocation(program, "altScale"), scaleFactor);
-			glUniform1f(glGetUniformLocation(program, "radiusEarthM"), (float)RADIUS_EARTH_M);
-
-			glUniform1f(glGetUniformLocation(program, "totalTime"), totalTime);
-			glUniform1f(glGetUniformLocation(program, "timeMultiplier"), timeMultiplier);
-			glUniform1f(glGetUniformLocation(program, "timeRepeat"), timeRepeat);
-			glUniform1f(glGetUniformLocation(program, "alphaPerSecond"), alphaPerSecond);
-			glUniform1f(glGetUniformLocation(program, "specularToggle"), (specular) ? 1.f : 0.f);
-			glUniform1f(glGetUniformLocation(program, "diffuseToggle"), (diffuse) ? 0.f : 1.f);
-
-			r->render();
-			glBindVertexArray(0);
+			r->assignBuffers();
+			r->setBufferData();
 		}
+		glBindVertexArray(r->getVAO());
+		r->render();
+	}
+	glBindVertexArray(0);
+}
+
+
+// Creates (or recreates) the offscreen targets for order independent transparency at the viewport size
+// Targets have as many samples as the window so lines keep their antialiasing. Composite resolves per sample
+void RenderEngine::createOITBuffers() {
+
+	deleteOITBuffers();
+
+	// Sample count of the default framebuffer, limited to what float colour targets support
+	GLint windowSamples = 0;
+	GLint maxSamples = 1;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGetIntegerv(GL_SAMPLES, &windowSamples);
+	glGetIntegerv(GL_MAX_COLOR_TEXTURE_SAMPLES, &maxSamples);
+	oitSamples = std::max(1, std::min(windowSamples, maxSamples));
+
+	glGenFramebuffers(1, &oitFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, oitFramebuffer);
+
+	// Weighted colour sum and weighted alpha sum
+	glGenTextures(1, &accumTexture);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, accumTexture);
+	glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, oitSamples, GL_RGBA16F, width, height, GL_TRUE);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, accumTexture, 0);
+
+	// Product of (1 - alpha), i.e. how much of the background is revealed
+	glGenTextures(1, &revealTexture);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, revealTexture);
+	glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, oitSamples, GL_R16F, width, height, GL_TRUE);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D_MULTISAMPLE, revealTexture, 0);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+
+	glGenRenderbuffers(1, &oitDepthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, oitDepthBuffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, oitSamples, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, oitDepthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+	glDrawBuffers(2, drawBuffers);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "OIT framebuffer incomplete" << std::endl;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+// Deletes the offscreen targets for order independent transparency if they exist
+void RenderEngine::deleteOITBuffers() {
+
+	if (oitFramebuffer != 0) {
+		glDeleteFramebuffers(1, &oitFramebuffer);
+		glDeleteTextures(1, &accumTexture);
+		glDeleteTextures(1, &revealTexture);
+		glDeleteRenderbuffers(1, &oitDepthBuffer);
+		oitFramebuffer = 0;
 	}
 }
 
 
+// Fills the frame uniform buffer with values that are the same for every object and binds it
+//
+// view - view matrix
+void RenderEngine::setFrameUniforms(const glm::dmat4& view) {
+
+	FrameUniforms u;
+
+	// Get eye position from model view matrix
+	glm::dmat4 modelViewD = view;
+
+	glm::dmat4 inv = glm::inverse(modelViewD);
+	glm::dvec3 eyePos = inv[3];
+	u.eyeHigh = eyePos;
+	u.eyeLow = eyePos - (glm::dvec3)u.eyeHigh;
+
+	// Set eye position to origin
+	modelViewD[3] = glm::dvec4(0.0, 0.0, 0.0, 1.0);
+	u.modelView = modelViewD;
+	u.projection = projection;
+
+	u.altScale = scaleFactor;
+	u.radiusEarthM = (float)RADIUS_EARTH_M;
+
+	u.totalTime = totalTime;
+	u.timeMultiplier = timeMultiplier;
+	u.timeRepeat = timeRepeat;
+	u.alphaPerSecond = alphaPerSecond;
+	u.specularToggle = (specular) ? 1.f : 0.f;
+	u.diffuseToggle = (diffuse) ? 0.f : 1.f;
+	u.maxAltM = (float)mbarsToAlt(1.0);
+
+	// Binding point 0 is shared by all engines so rebind every frame
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &u);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, frameUniformBuffer);
+}
+
+
 // Sets projection and viewport for new width and height
 //
 // newX - new left viewport x
@@ -202,12 +363,18 @@ void RenderEngine::render(const std::vector<Renderable*>& objects, const glm::dm
 // newWidth - new viewport width
 // newHeight - new viewport height
 void RenderEngine::setViewport(int newX, int newY, int newWidth, int newHeight) {
+	bool sizeChanged = (newWidth != width || newHeight != height);
+
 	x = newX;
 	y = newY;
 	width = newWidth;
 	height = newHeight;
 	projection = glm::perspective(fovYRad, (double)width / height, near, far);
 	glViewport(x, y, width, height);
+
+	if (sizeChanged) {
+		createOITBuffers();
+	}
 }
 
 
@@ -258,6 +425,50 @@ void RenderEngine::updatePlanes(double cameraDist) {
 }
 
 
+// Sets the colour ramp streamlines are coloured with. Index 0 is the surface and the last index is the top of the field
+//
+// ramp - list of colours from low to high altitude
+void RenderEngine::setColourRamp(const std::vector<glm::u8vec3>& ramp) {
+
+	if (colourRampTexture == 0) {
+		glGenTextures(1, &colourRampTexture);
+		glBindTexture(GL_TEXTURE_1D, colourRampTexture);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_1D, colourRampTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB8, (GLsizei)ramp.size(), 0, GL_RGB, GL_UNSIGNED_BYTE, ramp.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_1D, 0);
+}
+
+
+// Moves the shared upload ring to its next segment. Call once per frame before anything is rendered, since the
+// main view and every subwindow upload into the same segment
+void RenderEngine::beginFrame() {
+	if (uploadRing != nullptr) {
+		uploadRing->beginFrame();
+	}
+}
+
+
+// Frees GL objects shared by all engines. Call once on shutdown while the context is still current
+void RenderEngine::releaseShared() {
+
+	if (uploadRing != nullptr) {
+		Renderable::setUploadRing(nullptr);
+		delete uploadRing;
+		uploadRing = nullptr;
+	}
+	if (colourRampTexture != 0) {
+		glDeleteTextures(1, &colourRampTexture);
+		colourRampTexture = 0;
+	}
+}
+
+
 // Converts window pixel location to normalized device coordinate of viewport
 //
 // xPix - x in pixels right
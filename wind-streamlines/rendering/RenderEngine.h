@@ -7,8 +7,29 @@
 #include <vector>
 
 class Renderable;
+class UploadRing;
 class Window;
 
+enum class Shader;
+
+
+// Uniforms that are the same for every object in a frame. Layout matches the std140 FrameUniforms block in the shaders
+struct FrameUniforms {
+	glm::mat4 modelView;
+	glm::mat4 projection;
+	glm::vec3 eyeHigh;
+	float altScale;
+	glm::vec3 eyeLow;
+	float radiusEarthM;
+	float totalTime;
+	float timeMultiplier;
+	float timeRepeat;
+	float alphaPerSecond;
+	float specularToggle;
+	float diffuseToggle;
+	float maxAltM;
+	float padding;
+};
 
 // Class for managing and rendering to an SDL OpenGL window
 // TODO better integration/communication with Renderable classes
@@ -17,6 +38,10 @@ class RenderEngine {
 public:
 	RenderEngine(const Window& window, double cameraDist);
 	RenderEngine(const Window& window, int x, int y, int width, int height, double cameraDist);
+	~RenderEngine();
+
+	RenderEngine(const RenderEngine&) = delete;
+	RenderEngine& operator=(const RenderEngine&) = delete;
  
 	void clearViewport();
 	void render(const std::vector<Renderable*>& objects, const glm::dmat4& view, float dTimeS);
@@ -29,13 +54,26 @@ public:
 
 	double getFovY() const { return fovYRad; }
 	double getAspectRatio() const { return (float)width/height; }
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
 	double getNear() const { return near; }
 	double getFar() const { return far; }
 	const glm::dmat4& getProjection() const { return projection; }
 
 	void ImGui();
+
+	static void setColourRamp(const std::vector<glm::u8vec3>& ramp);
+	static void beginFrame();
+	static void releaseShared();
 	
 private:
+	static GLuint colourRampTexture;
+
+	// New geometry streams in at most one staging segment per frame, shared by all engines
+	static constexpr size_t uploadSegmentSize = 8 * 1024 * 1024;
+	static constexpr int uploadSegments = 3;
+	static UploadRing* uploadRing;
+
 	const Window& window;
 
 	int x, y;
@@ -61,7 +99,22 @@ private:
 	GLuint mainProgram;
 	GLuint streamlineProgram;
 	GLuint streamlineProgram2;
+	GLuint compositeProgram;
+
+	GLuint frameUniformBuffer;
+	GLuint emptyVAO;
+
+	GLuint oitFramebuffer;
+	GLsizei oitSamples;
+	GLuint accumTexture;
+	GLuint revealTexture;
+	GLuint oitDepthBuffer;
 
 	glm::dmat4 projection;
+
+	void setFrameUniforms(const glm::dmat4& view);
+	void renderObjects(const std::vector<Renderable*>& objects, Shader type, GLuint program);
+	void createOITBuffers();
+	void deleteOITBuffers();
 };
 
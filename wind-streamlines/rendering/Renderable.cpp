@@ -1,33 +1,27 @@
 #include "Renderable.h"
 
-#include "Conversions.h"
+#include "UploadRing.h"
 
 
-// Construct renderable from geometry specified in json document
-//
-// d - json data
-ColourRenderable::ColourRenderable(const rapidjson::Document& d) {
-
-	drawMode = GL_LINES;
-	const rapidjson::Value& featuresArray = d["features"];
-
-	// Loop over lines in data file
-	for (rapidjson::SizeType i = 0; i < featuresArray.Size(); i++) {
-		const rapidjson::Value& coordArray = featuresArray[i]["geometry"]["coordinates"];
+// Uploads go through the ring when the render engine has created one
+UploadRing* Renderable::uploadRing = nullptr;
 
-		for (rapidjson::SizeType j = 0; j < coordArray.Size(); j++) {
-			double lng = coordArray[j][0].GetDouble() * M_PI / 180.0;
-			double lat = coordArray[j][1].GetDouble() * M_PI / 180.0;
 
-			addVert(glm::dvec3(sin(lng)*cos(lat), sin(lat), cos(lng)*cos(lat)) * RADIUS_EARTH_M);
-			colours.push_back(glm::u8vec3(255, 255, 255));
-
-			if (j != 0 && j != coordArray.Size() - 1) {
-				addVert(glm::dvec3(sin(lng)*cos(lat), sin(lat), cos(lng)*cos(lat)) * RADIUS_EARTH_M);
-				colours.push_back(glm::u8vec3(255, 255, 255));
-			}
-		}
-	}
+// Replace vertex data with arrays that are already split into high and low precision parts
+//
+// high - high precision part of each vertex
+// low - low precision part of each vertex
+// cols - colour of each vertex
+// numVerts - number of vertices in each array
+// inds - vertex indices to draw with, vertices are drawn in order if there are none
+// numIndices - number of indices
+void ColourRenderable::setArrays(const glm::vec3* high, const glm::vec3* low, const glm::u8vec3* cols, size_t numVerts,
+	const GLuint* inds, size_t numIndices) {
+
+	vertsHigh.assign(high, high + numVerts);
+	vertsLow.assign(low, low + numVerts);
+	colours.assign(cols, cols + numVerts);
+	indices.assign(inds, inds + numIndices);
 }
 
 
@@ -37,6 +31,24 @@ void Renderable::deleteBufferData() {
 }
 
 
+// Allocate and fill a buffer. Streams through the upload ring if there is one
+//
+// buffer - buffer to fill
+// size - number of bytes
+// data - data to upload
+// target - binding point of buffer. Element buffers need the owning VAO bound
+void Renderable::bufferData(GLuint buffer, size_t size, const void* data, GLenum target) {
+
+	if (uploadRing != nullptr) {
+		uploadRing->bufferData(target, buffer, size, data);
+	}
+	else {
+		glBindBuffer(target, buffer);
+		glBufferData(target, size, data, GL_STATIC_DRAW);
+	}
+}
+
+
 // Add vertex to list of verts
 //
 // v - vertex to add
@@ -74,12 +86,10 @@ void DoublePrecisionRenderable::assignBuffers() {
 void DoublePrecisionRenderable::setBufferData() {
 
 	// Vertex high buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertexHighBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*vertsHigh.size(), vertsHigh.data(), GL_DYNAMIC_DRAW);
+	bufferData(vertexHighBuffer, sizeof(glm::vec3)*vertsHigh.size(), vertsHigh.data());
 
 	// Vertex low buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertexLowBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*vertsLow.size(), vertsLow.data(), GL_DYNAMIC_DRAW);
+	bufferData(vertexLowBuffer, sizeof(glm::vec3)*vertsLow.size(), vertsLow.data());
 }
 
 
@@ -101,6 +111,10 @@ void ColourRenderable::assignBuffers() {
 	glBindBuffer(GL_ARRAY_BUFFER, colourBuffer);
 	glVertexAttribPointer(2, 3, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void*)0);
 	glEnableVertexAttribArray(2);
+
+	// Index buffer, binding is part of VAO state
+	glGenBuffers(1, &indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
 }
 
 
@@ -110,28 +124,68 @@ void ColourRenderable::setBufferData() {
 	DoublePrecisionRenderable::setBufferData();
 
 	// Colour buffer
-	glBindBuffer(GL_ARRAY_BUFFER, colourBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::u8vec3)*colours.size(), colours.data(), GL_DYNAMIC_DRAW);
+	bufferData(colourBuffer, sizeof(glm::u8vec3)*colours.size(), colours.data());
+
+	// Index buffer
+	glBindVertexArray(vao);
+	bufferData(indexBuffer, sizeof(GLuint)*indices.size(), indices.data(), GL_ELEMENT_ARRAY_BUFFER);
+	glBindVertexArray(0);
 }
 
 
 // Delete GPU buffers for object
 void ColourRenderable::deleteBufferData() {
 	glDeleteBuffers(1, &colourBuffer);
+	glDeleteBuffers(1, &indexBuffer);
 	DoublePrecisionRenderable::deleteBufferData();
 }
 
 
 // Make the appropriate OpenGL render call for the object
 void ColourRenderable::render() const {
-	glDrawArrays(drawMode, 0, (GLsizei)vertsHigh.size());
+	if (indices.empty()) {
+		glDrawArrays(drawMode, 0, (GLsizei)vertsHigh.size());
+	}
+	else {
+		glDrawElements(drawMode, (GLsizei)indices.size(), GL_UNSIGNED_INT, (void*)0);
+	}
+}
+
+
+// Construct renderable with space for a known number of vertices. Fill with setVert
+//
+// numVerts - number of vertices
+StreamlineRenderable::StreamlineRenderable(size_t numVerts) :
+	tangents(numVerts),
+	localTimes(numVerts) {
+
+	vertsHigh.resize(numVerts);
+	vertsLow.resize(numVerts);
+}
+
+
+// Set vertex in place. Different vertices can be set from different threads
+//
+// i - index of vertex
+// v - position of vertex
+// t - tangent of line at vertex
+// localTime - integration time of vertex
+void StreamlineRenderable::setVert(size_t i, const glm::dvec3& v, const glm::vec3& t, float localTime) {
+
+	// Split into high and low precision components
+	glm::vec3 high = v;
+
+	vertsHigh[i] = high;
+	vertsLow[i] = v - (glm::dvec3)high;
+	tangents[i] = t;
+	localTimes[i] = localTime;
 }
 
 
 // Assign GPU buffers for object
 void StreamlineRenderable::assignBuffers() {
 
-	ColourRenderable::assignBuffers();
+	DoublePrecisionRenderable::assignBuffers();
 
 	// Tangent buffer
 	glGenBuffers(1, &tangentBuffer);
@@ -150,15 +204,13 @@ void StreamlineRenderable::assignBuffers() {
 // Set data in GPU buffers
 void StreamlineRenderable::setBufferData() {
 
-	ColourRenderable::setBufferData();
+	DoublePrecisionRenderable::setBufferData();
 
 	// Tangent buffer
-	glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*tangents.size(), tangents.data(), GL_DYNAMIC_DRAW);
+	bufferData(tangentBuffer, sizeof(glm::vec3)*tangents.size(), tangents.data());
 
 	// Time buffer
-	glBindBuffer(GL_ARRAY_BUFFER, timeBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*localTimes.size(), localTimes.data(), GL_DYNAMIC_DRAW);
+	bufferData(timeBuffer, sizeof(float)*localTimes.size(), localTimes.data());
 }
 
 
@@ -166,5 +218,11 @@ void StreamlineRenderable::setBufferData() {
 void StreamlineRenderable::deleteBufferData() {
 	glDeleteBuffers(1, &timeBuffer);
 	glDeleteBuffers(1, &tangentBuffer);
-	ColourRenderable::deleteBufferData();
+	DoublePrecisionRenderable::deleteBufferData();
+}
+
+
+// Make the appropriate OpenGL render call for the object
+void StreamlineRenderable::render() const {
+	glDrawArrays(GL_LINES, 0, (GLsizei)vertsHigh.size());
 }
\ No newline at end of file
@@ -2,10 +2,10 @@
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
-#include <rapidjson/document.h>
 
-#include <vector>
+#include "UploadRing.h"
 
+#include <vector>
 
 // Enumeration of different shaders
 enum class Shader {
@@ -26,11 +26,21 @@ public:
 	virtual void deleteBufferData();
 
 	GLuint getVAO() const { return vao; }
+
+	// Bytes this object takes in the upload budget, with each buffer rounded up as the upload ring does
+	virtual size_t dataSize() const = 0;
 	virtual Shader getShaderType() const = 0;
 	virtual void render() const = 0;
 
+	static void setUploadRing(UploadRing* ring) { uploadRing = ring; }
+
 protected:
 	GLuint vao;
+
+	static void bufferData(GLuint buffer, size_t size, const void* data, GLenum target = GL_ARRAY_BUFFER);
+
+private:
+	static UploadRing* uploadRing;
 };
 
 
@@ -43,17 +53,21 @@ public:
 	virtual void addVert(const glm::dvec3& v);
 
 	virtual size_t size() { return vertsHigh.size(); }
+	virtual size_t dataSize() const { return 2 * UploadRing::alignedSize(sizeof(glm::vec3) * vertsHigh.size()); }
 
 	virtual void assignBuffers();
 	virtual void setBufferData();
 	virtual void deleteBufferData();
 
+	const std::vector<glm::vec3>& getVertsHigh() const { return vertsHigh; }
+	const std::vector<glm::vec3>& getVertsLow() const { return vertsLow; }
+
 protected:
 	std::vector<glm::vec3> vertsHigh;
 	std::vector<glm::vec3> vertsLow;
 
-	GLuint vertexHighBuffer;
-	GLuint vertexLowBuffer;
+	GLuint vertexHighBuffer = 0;
+	GLuint vertexLowBuffer = 0;
 };
 
 
@@ -62,10 +76,13 @@ class ColourRenderable : public DoublePrecisionRenderable {
 
 public:
 	ColourRenderable() = default;
-	ColourRenderable(const rapidjson::Document& d);
 	virtual ~ColourRenderable() { deleteBufferData(); }
 
 	virtual void addColour(const glm::u8vec3& c) { colours.push_back(c); }
+	virtual size_t dataSize() const {
+		return DoublePrecisionRenderable::dataSize() + UploadRing::alignedSize(sizeof(glm::u8vec3) * colours.size()) +
+			UploadRing::alignedSize(sizeof(GLuint) * indices.size());
+	}
 
 	virtual void assignBuffers();
 	virtual void setBufferData();
@@ -75,35 +92,52 @@ public:
 	virtual void render() const;
 
 	void setDrawMode(GLuint mode) { drawMode = mode; }
+	GLuint getDrawMode() const { return drawMode; }
+	const std::vector<glm::u8vec3>& getColours() const { return colours; }
+	const std::vector<GLuint>& getIndices() const { return indices; }
+
+	void setArrays(const glm::vec3* high, const glm::vec3* low, const glm::u8vec3* cols, size_t numVerts,
+		const GLuint* inds = nullptr, size_t numIndices = 0);
 
 protected:
 	GLuint drawMode;
 
 	std::vector<glm::u8vec3> colours;
+	std::vector<GLuint> indices;
 
-	GLuint colourBuffer;
+	GLuint colourBuffer = 0;
+	GLuint indexBuffer = 0;
 };
 
 
 // Class for renderable that is used for streamlines. Each vertex has a tangent and integration time
-class StreamlineRenderable : public ColourRenderable {
+// Colour comes from a colour ramp on the GPU so it can change without touching vertex data
+class StreamlineRenderable : public DoublePrecisionRenderable {
 
 public:
+	StreamlineRenderable() = default;
+	StreamlineRenderable(size_t numVerts);
 	virtual ~StreamlineRenderable() { deleteBufferData(); }
 
+	void setVert(size_t i, const glm::dvec3& v, const glm::vec3& t, float localTime);
+
 	virtual void addTangent(const glm::vec3& t) { tangents.push_back(t); }
 	virtual void addLocalTime(float localTime) { localTimes.push_back(localTime); }
+	virtual size_t dataSize() const {
+		return DoublePrecisionRenderable::dataSize() + UploadRing::alignedSize(sizeof(glm::vec3) * tangents.size()) +
+			UploadRing::alignedSize(sizeof(float) * localTimes.size());
+	}
 
 	virtual void assignBuffers();
 	virtual void setBufferData();
 	virtual void deleteBufferData();
 
 	virtual Shader getShaderType() const { return Shader::STREAMLINE; }
+	virtual void render() const;
 
 	void clear() {
 		localTimes.clear();
 		tangents.clear();
-		colours.clear();
 		vertsHigh.clear();
 		vertsLow.clear();
 	}
@@ -112,6 +146,6 @@ private:
 	std::vector<glm::vec3> tangents;
 	std::vector<float> localTimes;
 
-	GLuint tangentBuffer;
-	GLuint timeBuffer;
+	GLuint tangentBuffer = 0;
+	GLuint timeBuffer = 0;
 };
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "UploadRing.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+// Creates and maps the staging buffer if persistent mapping is supported
+//
+// segmentSize - bytes that can be staged per frame
+// numSegments - number of frames that can be in flight
+UploadRing::UploadRing(size_t segmentSize, int numSegments) :
+	segmentSize(segmentSize),
+	numSegments(numSegments),
+	persistent(GLEW_ARB_buffer_storage != 0),
+	stagingBuffer(0),
+	mapped(nullptr),
+	segment(0),
+	used(0),
+	fences(numSegments, nullptr) {
+
+	if (!persistent) {
+		return;
+	}
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLsizeiptr totalSize = segmentSize * numSegments;
+
+	glGenBuffers(1, &stagingBuffer);
+	glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+	glBufferStorage(GL_COPY_READ_BUFFER, totalSize, nullptr, flags);
+	mapped = (char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, totalSize, flags);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	if (mapped == nullptr) {
+		glDeleteBuffers(1, &stagingBuffer);
+		stagingBuffer = 0;
+		persistent = false;
+	}
+}
+
+
+// Unmaps and deletes staging buffer
+UploadRing::~UploadRing() {
+
+	for (GLsync& f : fences) {
+		if (f != nullptr) {
+			glDeleteSync(f);
+		}
+	}
+	if (persistent) {
+		glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glDeleteBuffers(1, &stagingBuffer);
+	}
+}
+
+
+// Fences what was staged since the last call and moves to the next segment. Waits until the GPU has finished
+// copying out of that segment the last time it was used
+void UploadRing::beginFrame() {
+
+	if (persistent && used > 0) {
+		fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	segment = (segment + 1) % numSegments;
+	used = 0;
+
+	GLsync& f = fences[segment];
+	if (f != nullptr) {
+		while (glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(f);
+		f = nullptr;
+	}
+}
+
+
+// Allocates storage for buffer and fills it with data. Data goes through the staging segment when it fits,
+// otherwise it is uploaded directly
+//
+// target - binding point to use for buffer
+// buffer - destination buffer
+// size - number of bytes
+// data - data to upload
+void UploadRing::bufferData(GLenum target, GLuint buffer, size_t size, const void* data) {
+
+	glBindBuffer(target, buffer);
+
+	// Direct uploads count against the budget as well
+	size_t alignedSize = UploadRing::alignedSize(size);
+	if (!persistent || size == 0 || alignedSize > remaining()) {
+		glBufferData(target, size, data, GL_STATIC_DRAW);
+		used = std::min(segmentSize, used + alignedSize);
+		return;
+	}
+
+	size_t offset = segment * segmentSize + used;
+	memcpy(mapped + offset, data, size);
+	used += alignedSize;
+
+	glBufferData(target, size, nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, target, offset, 0, size);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <vector>
+
+
+// Streams vertex data to the GPU through a persistently mapped staging buffer split into segments.
+// Each frame writes into its own segment which is fenced at the start of the next frame, so the CPU only waits if
+// the GPU is several frames behind.
+// Data is copied into the destination buffers on the GPU. Falls back to plain glBufferData without GL 4.4
+class UploadRing {
+
+public:
+	UploadRing(size_t segmentSize, int numSegments);
+	~UploadRing();
+
+	void beginFrame();
+
+	void bufferData(GLenum target, GLuint buffer, size_t size, const void* data);
+
+	size_t remaining() const { return segmentSize - used; }
+
+	// Space a buffer of the given size takes in a segment. Offsets are kept aligned for fast copies
+	static size_t alignedSize(size_t size) { return (size + 15) & ~(size_t)15; }
+
+private:
+	size_t segmentSize;
+	int numSegments;
+	bool persistent;
+
+	GLuint stagingBuffer;
+	char* mapped;
+
+	int segment;
+	size_t used;
+	std::vector<GLsync> fences;
+};
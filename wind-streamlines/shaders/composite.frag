@@ -0,0 +1,34 @@
+#version 430 core
+
+out vec4 colour;
+
+layout (binding = 0) uniform sampler2DMS accumTexture;
+layout (binding = 1) uniform sampler2DMS revealTexture;
+
+layout (location = 0) uniform int numSamples;
+
+in vec2 uv;
+
+void main(void) {    	
+
+	// Reading gl_SampleID runs this per sample of the window so each sample composites its own accumulation
+	ivec2 texel = ivec2(uv * vec2(textureSize(accumTexture)));
+	int s = gl_SampleID % numSamples;
+
+	float reveal = texelFetch(revealTexture, texel, s).r;
+
+	// Nothing was drawn here
+	if (reveal == 1.f) {
+		discard;
+	}
+	vec4 accum = texelFetch(accumTexture, texel, s);
+
+	// Avoid overflow from many overlapping lines
+	if (isinf(max(max(abs(accum.r), abs(accum.g)), abs(accum.b)))) {
+		accum.rgb = vec3(accum.a);
+	}
+	vec3 average = accum.rgb / max(accum.a, 1e-5);
+
+	// Blended with (1 - alpha, alpha) so background is scaled by reveal
+	colour = vec4(average, reveal);
+}
\ No newline at end of file
@@ -0,0 +1,11 @@
+#version 430 core
+
+out vec2 uv;
+
+void main(void) {	
+
+	// Full screen triangle generated from vertex ID
+	uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+
+    gl_Position = vec4(uv * 2.f - 1.f, 0.f, 1.f);
+}
@@ -1,14 +1,23 @@
 #version 430 core
 
-out vec4 colour;
-
-uniform float totalTime;
-uniform float timeMultiplier;
-uniform float timeRepeat;
-uniform float alphaPerSecond;
-
-uniform float specularToggle; // value of 0 turns off spec
-uniform float diffuseToggle; // value of 1 turns off diff
+layout (location = 0) out vec4 accum;
+layout (location = 1) out float reveal;
+
+layout (std140, binding = 0) uniform FrameUniforms {
+	mat4 modelView;
+	mat4 projection;
+	vec3 eyeHigh;
+	float altScale;
+	vec3 eyeLow;
+	float radiusEarthM;
+	float totalTime;
+	float timeMultiplier;
+	float timeRepeat;
+	float alphaPerSecond;
+	float specularToggle; // value of 0 turns off spec
+	float diffuseToggle; // value of 1 turns off diff
+	float maxAltM;
+};
 
 in vec3 C;
 in vec3 L;
@@ -39,6 +48,11 @@ void main(void) {
 
 	float expon = mod(totalTime - t, timeRepeat) / timeMultiplier;
 	float alpha = pow(alphaPerSecond, expon);
-	
-	colour = vec4(ka + kd + ks, alpha);
+
+	// Weighted blended OIT. Weight is the variant from McGuire's 2015 blog post "Implementing Weighted, Blended
+	// Order-Independent Transparency", not eq. 10 of McGuire and Bavoil 2013
+	float weight = clamp(pow(min(1.f, alpha * 10.f) + 0.01f, 3.f) * 1e8 * pow(1.f - gl_FragCoord.z * 0.9f, 3.f), 1e-2, 3e3);
+
+	accum = vec4((ka + kd + ks) * alpha, alpha) * weight;
+	reveal = alpha;
 }
\ No newline at end of file
@@ -1,17 +1,26 @@
 #version 430 core
 
-uniform mat4 modelView;
-uniform mat4 projection;
-
-uniform vec3 eyeHigh;
-uniform vec3 eyeLow;
-
-uniform float altScale;
-uniform float radiusEarthM;
+layout (std140, binding = 0) uniform FrameUniforms {
+	mat4 modelView;
+	mat4 projection;
+	vec3 eyeHigh;
+	float altScale;
+	vec3 eyeLow;
+	float radiusEarthM;
+	float totalTime;
+	float timeMultiplier;
+	float timeRepeat;
+	float alphaPerSecond;
+	float specularToggle; // value of 0 turns off spec
+	float diffuseToggle; // value of 1 turns off diff
+	float maxAltM;
+};
+
+// Colour by normalized altitude
+layout (binding = 2) uniform sampler1D colourRamp;
 
 layout (location = 0) in vec3 vertexHigh;
 layout (location = 1) in vec3 vertexLow;
-layout (location = 2) in vec3 colour;
 layout (location = 3) in vec3 tangent;
 layout (location = 4) in float localTime;
 
@@ -42,7 +51,7 @@ void main(void) {
 	L = normalize(lightPos - vertexHigh);
 	V = normalize(eyeHigh - vertexHigh);
 	T = tangent;
-	C = colour;
+	C = textureLod(colourRamp, (len - radiusEarthM) / maxAltM, 0.f).rgb;
 	t = localTime;
 
 	vec4 pCamera = modelView * vec4(vertex, 1.f);
@@ -2,10 +2,21 @@
 
 out vec4 colour;
 
-uniform float totalTime;
-uniform float timeMultiplier;
-uniform float timeRepeat;
-uniform float alphaPerSecond;
+layout (std140, binding = 0) uniform FrameUniforms {
+	mat4 modelView;
+	mat4 projection;
+	vec3 eyeHigh;
+	float altScale;
+	vec3 eyeLow;
+	float radiusEarthM;
+	float totalTime;
+	float timeMultiplier;
+	float timeRepeat;
+	float alphaPerSecond;
+	float specularToggle; // value of 0 turns off spec
+	float diffuseToggle; // value of 1 turns off diff
+	float maxAltM;
+};
 
 in float t;
 
@@ -1,17 +1,23 @@
 #version 430 core
 
-uniform mat4 modelView;
-uniform mat4 projection;
-
-uniform vec3 eyeHigh;
-uniform vec3 eyeLow;
-
-uniform float altScale;
-uniform float radiusEarthM;
+layout (std140, binding = 0) uniform FrameUniforms {
+	mat4 modelView;
+	mat4 projection;
+	vec3 eyeHigh;
+	float altScale;
+	vec3 eyeLow;
+	float radiusEarthM;
+	float totalTime;
+	float timeMultiplier;
+	float timeRepeat;
+	float alphaPerSecond;
+	float specularToggle; // value of 0 turns off spec
+	float diffuseToggle; // value of 1 turns off diff
+	float maxAltM;
+};
 
 layout (location = 0) in vec3 vertexHigh;
 layout (location = 1) in vec3 vertexLow;
-layout (location = 2) in vec3 colour;
 layout (location = 3) in vec3 tangent;
 layout (location = 4) in float localTime;
 
@@ -0,0 +1,110 @@
+#include "BrickCache.h"
+
+#include <algorithm>
+
+
+std::atomic<uint64_t> BrickCache::nextId(1);
+
+
+// Create cache for a field of given size
+//
+// numLats - number of latitudes of field
+// numLongs - number of longitudes of field
+// numLevels - number of levels of field
+// maxBytes - memory of the shared cache. Always holds at least one brick, and each thread using the cache can hold up
+//            to NUM_RECENT more
+// loader - callback that fills a brick
+BrickCache::BrickCache(size_t numLats, size_t numLongs, size_t numLevels, size_t maxBytes, Loader loader) :
+	id(nextId++),
+	numLatBricks((numLats + BRICK_LATS - 1) / BRICK_LATS),
+	numLongBricks((numLongs + BRICK_LONGS - 1) / BRICK_LONGS),
+	maxBricks(std::max(maxBytes / (BRICK_SIZE * sizeof(Eigen::Vector3d)), (size_t)1)),
+	loader(loader),
+	liveBricks(std::make_shared<std::atomic<size_t>>(0)) {}
+
+
+// Returns vector data at lat, long, level index, loading its brick if needed
+// Reference is only valid until this thread has used NUM_RECENT other bricks, so copy the value right away
+//
+// lat - latitude index
+// lng - longitude index
+// lvl - level index
+// return - vector at index
+const Eigen::Vector3d& BrickCache::at(size_t lat, size_t lng, size_t lvl) const {
+
+	size_t b = ((lvl / BRICK_LEVELS) * numLatBricks + lat / BRICK_LATS) * numLongBricks + lng / BRICK_LONGS;
+	size_t i = ((lvl % BRICK_LEVELS) * BRICK_LATS + lat % BRICK_LATS) * BRICK_LONGS + lng % BRICK_LONGS;
+
+	// Most recently used first
+	thread_local RecentBrick recent[NUM_RECENT];
+
+	for (int k = 0; k < NUM_RECENT; k++) {
+		if (recent[k].cache == id && recent[k].index == b) {
+			std::rotate(recent, recent + k, recent + k + 1);
+			return (*recent[0].brick)[i];
+		}
+	}
+
+	std::shared_ptr<const Brick> brick = fetch(b, lat - lat % BRICK_LATS, lng - lng % BRICK_LONGS, lvl - lvl % BRICK_LEVELS);
+	std::rotate(recent, recent + NUM_RECENT - 1, recent + NUM_RECENT);
+	recent[0].cache = id;
+	recent[0].index = b;
+	recent[0].brick = std::move(brick);
+
+	return (*recent[0].brick)[i];
+}
+
+
+// Returns number of bricks in memory, in the shared cache or only held by threads
+//
+// return - number of bricks
+size_t BrickCache::residentBricks() const {
+	return *liveBricks;
+}
+
+
+// Gets a brick from the shared cache, loading it if it is not there. Loading happens without the lock so threads
+// using other bricks are not held up. Two threads may load the same brick at once, the second one uses the first
+// one's copy
+//
+// b - index of brick
+// lat - latitude index of first point of brick
+// lng - longitude index of first point of brick
+// lvl - level index of first point of brick
+// return - brick
+std::shared_ptr<const BrickCache::Brick> BrickCache::fetch(size_t b, size_t lat, size_t lng, size_t lvl) const {
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = bricks.find(b);
+		if (it != bricks.end()) {
+			lru.splice(lru.begin(), lru, it->second.lruPos);
+			return it->second.brick;
+		}
+	}
+
+	std::shared_ptr<std::atomic<size_t>> live = liveBricks;
+	(*live)++;
+	std::shared_ptr<Brick> brick(new Brick(BRICK_SIZE, Eigen::Vector3d::Zero()), [live](Brick* b) {
+		(*live)--;
+		delete b;
+	});
+	loader(lat, lng, lvl, *brick);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = bricks.find(b);
+	if (it != bricks.end()) {
+		lru.splice(lru.begin(), lru, it->second.lruPos);
+		return it->second.brick;
+	}
+
+	lru.push_front(b);
+	bricks[b] = Entry{ brick, lru.begin() };
+
+	// Evicting a brick a thread still holds frees nothing yet, it is freed once the thread moves on
+	while (lru.size() > maxBricks) {
+		bricks.erase(lru.back());
+		lru.pop_back();
+	}
+	return brick;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+// Bounded least recently used cache of bricks of a field, for fields too large to hold in memory. Bricks are loaded
+// on demand by a callback. Each thread first checks a few bricks it used recently, which it holds references to so
+// they stay valid even after the shared cache evicts them. Streamlines move coherently through the field so nearly
+// all lookups hit there without locking. Bricks only held by threads do not count against the limit of the shared
+// cache, so many threads can not shrink it to nothing. They add at most NUM_RECENT bricks per thread
+class BrickCache {
+
+public:
+	static const size_t BRICK_LATS = 32;
+	static const size_t BRICK_LONGS = 32;
+	static const size_t BRICK_LEVELS = 8;
+	static const size_t BRICK_SIZE = BRICK_LATS * BRICK_LONGS * BRICK_LEVELS;
+
+	// Number of recently used bricks each thread holds on to. Enough for all corners of a cell at a brick corner
+	static const int NUM_RECENT = 8;
+
+	// Points of a brick, level then latitude then longitude major
+	typedef std::vector<Eigen::Vector3d> Brick;
+
+	// Fills a brick given the (lat, long, level) index of its first point. Bricks at the edges of the field are only
+	// partly filled
+	typedef std::function<void(size_t, size_t, size_t, Brick&)> Loader;
+
+	BrickCache(size_t numLats, size_t numLongs, size_t numLevels, size_t maxBytes, Loader loader);
+
+	const Eigen::Vector3d& at(size_t lat, size_t lng, size_t lvl) const;
+	size_t residentBricks() const;
+
+private:
+	struct Entry {
+		std::shared_ptr<const Brick> brick;
+		std::list<size_t>::iterator lruPos;
+	};
+
+	struct RecentBrick {
+		uint64_t cache = 0;
+		size_t index = 0;
+		std::shared_ptr<const Brick> brick;
+	};
+
+	static std::atomic<uint64_t> nextId;
+
+	// Identifies this cache in per thread lists, which are shared by all caches
+	uint64_t id;
+
+	size_t numLatBricks;
+	size_t numLongBricks;
+	size_t maxBricks;
+	Loader loader;
+
+	// Number of bricks in memory, in the shared cache or only in recent lists. Decremented when a brick is freed,
+	// which can happen after the cache is gone. Only used for statistics
+	std::shared_ptr<std::atomic<size_t>> liveBricks;
+
+	mutable std::mutex mutex;
+	mutable std::unordered_map<size_t, Entry> bricks;
+	mutable std::list<size_t> lru;
+
+	std::shared_ptr<const Brick> fetch(size_t b, size_t lat, size_t lng, size_t lvl) const;
+};
@@ -1,13 +1,19 @@
 #include "SeedingEngine.h"
 
+#include "color/Ramp.h"
 #include "Conversions.h"
 #include "Frustum.h"
+#include "rendering/RenderEngine.h"
 #include "SphericalVectorField.h"
 #include "VoxelGrid.h"
 
 #include <imgui.h>
 
 #include <algorithm>
+#include <chrono>
+#include <execution>
+#include <limits>
+#include <numeric>
 #include <queue>
 #include <random>
 
@@ -15,7 +21,18 @@
 // Dear ImGUI window. Slider for controlling multiscale
 void SeedingEngine::ImGui() {
 	if (ImGui::CollapsingHeader("Streamlines")) {
-		ImGui::SliderInt("Show levels", &showLevels, 1, numLevels);
+		ImGui::Checkbox("Automatic levels", &autoLevels);
+		if (autoLevels) {
+			ImGui::SliderFloat("Line spacing (px)", &lineSpacingPx, 5.f, 200.f);
+		}
+		else {
+			ImGui::SliderInt("Show levels", &showLevels, 1, numLevels);
+		}
+		ImGui::InputInt("Levels", &targetLevels);
+		ImGui::SliderFloat("Seperation scale", &targetSepScale, 0.25f, maxSepScale);
+		if (ImGui::Button("Apply seeding changes")) {
+			applySeedingChanges();
+		}
 		updateCols = updateCols || ImGui::Checkbox("Second colour", &bothCols);
 		updateCols = updateCols || ImGui::ColorEdit3("Colour 1", &col1.x);
 		if (bothCols) {
@@ -28,134 +45,753 @@ void SeedingEngine::ImGui() {
 // Create engine for the provided vector field
 //
 // field - spherical vector field that will be seeded
-SeedingEngine::SeedingEngine(SphericalVectorField & field) :
+// headless - if true no geometry is built and there is no background refinement, for seeding without a window
+SeedingEngine::SeedingEngine(SphericalVectorField & field, bool headless) :
 	field(field),
+	headless(headless),
+	tiledSeeding(false),
+	stopRefine(false),
 	numLevels(5),
 	showLevels(1),
-	updateCols(false),
+	sepScale(1.f),
+	targetLevels(5),
+	targetSepScale(1.f),
+	autoLevels(true),
+	lineSpacingPx(30.f),
+	updateCols(true),
 	bothCols(true),
 	col1(0.f, 0.f, 0.545f),
 	col2(0.f, 1.f, 1.f) {}
 
 
-// Seed streamlines
+// Stops background refinement before destroying lines
+SeedingEngine::~SeedingEngine() {
+	stopRefinement();
+}
+
+
+// Seed all levels from scratch
 void SeedingEngine::seed() {
 
-	double minLength = 1000000.0 * 1.25;
-	double sepDist = 200000.0 * 1.25;
+	stopRefinement();
+	{
+		std::unique_lock<std::shared_mutex> lock(levelsMutex);
+
+		for (std::vector<Streamline>& v : streamlines) {
+			for (Streamline& s : v) {
+				s.deleteRenderable();
+			}
+		}
+		streamlines.clear();
+		sepDists.clear();
+		minLengths.clear();
+		grids.clear();
+
+		// Multiresolution streamlines
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		for (int i = 0; i < numLevels; i++) {
+			addLevel();
+		}
+		std::chrono::duration<double> dTimeS = std::chrono::steady_clock::now() - t0;
+		std::cout << "Seeding took " << dTimeS.count() << " s" << std::endl;
+	}
+
+	if (!headless) {
+		startRefinement();
+	}
+}
+
 
-	// Multiresolution streamlines
-	for (int i = 0; i < numLevels; i++) {
+// Sets number of levels and seperation scale used by the next call to seed
+//
+// levels - number of levels
+// scale - multiplier for seperation distance of all levels
+void SeedingEngine::setSeedingParams(int levels, float scale) {
+	numLevels = targetLevels = std::max(levels, 1);
+	sepScale = targetSepScale = scale;
+	showLevels = std::min(showLevels, numLevels);
+}
 
-		streamlines.push_back(std::vector<Streamline>());
 
-		minLength *= 0.8;
-		sepDist *= 0.8;
+// Applies changes to the number of levels and seperation made in the UI, reusing as much existing work as possible
+// Adding levels keeps every existing level. Reducing seperation only fills gaps between existing lines.
+// Increasing seperation can not remove lines so it requires seeding from scratch
+void SeedingEngine::applySeedingChanges() {
 
-		VoxelGrid vg(mbarsToAbs(1.0) + 100.0, sepDist);
-		std::queue<Streamline> seedLines;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	targetLevels = std::max(targetLevels, 1);
 
-		// Need a starting streamline to seed off of
-		if (i == 0) {
-			Streamline first = field.streamline(Eigen::Vector3d(0.0, 1.0, 999.0), 10000000.0, 1000.0, 10000.0, vg);
-			seedLines.push(first);
-			first.createRenderable(col1, col2);
-			streamlines[0].push_back(first);
-		}
+	if (targetSepScale > sepScale) {
+		sepScale = targetSepScale;
+		numLevels = targetLevels;
+		seed();
+	}
+	else {
+		stopRefinement();
+		{
+			std::unique_lock<std::shared_mutex> lock(levelsMutex);
+
+			if (targetSepScale < sepScale) {
+				sepScale = targetSepScale;
+
+				for (size_t i = 0; i < streamlines.size(); i++) {
+					sepDists[i] = baseSepDist * sepScale * pow(0.8, i);
+					grids[i].setSepDist(sepDists[i]);
+					seedLevel(i);
+					if (!headless) {
+						buildRenderables(streamlines[i]);
+					}
+					std::cout << i << " refilled" << std::endl;
+				}
+			}
 
-		// Put all streamline points in voxel grid
-		for (int j = 0; j < i; j++) {
-			for (Streamline& s : streamlines[j]) {
-				for (const Eigen::Vector3d& p : s.getPoints()) {
-					vg.addPoint(p);
+			// Dropping levels leaves coarser levels and their grids untouched
+			while ((int)streamlines.size() > targetLevels) {
+				for (Streamline& s : streamlines.back()) {
+					s.deleteRenderable();
 				}
-				seedLines.push(s);
+				streamlines.pop_back();
+				sepDists.pop_back();
+				minLengths.pop_back();
+				grids.pop_back();
 			}
+			while ((int)streamlines.size() < targetLevels) {
+				addLevel();
+			}
+			numLevels = targetLevels;
 		}
+		startRefinement();
+	}
+	showLevels = std::min(showLevels, numLevels);
 
-		// Seed until you can't seed no more
-		while (!seedLines.empty()) {
+	std::chrono::duration<double> dTimeS = std::chrono::steady_clock::now() - t0;
+	std::cout << "Seeding update took " << dTimeS.count() << " s" << std::endl;
+}
 
-			Streamline seedLine = seedLines.front();
-			seedLines.pop();
 
-			std::vector<Eigen::Vector3d> seeds = seedLine.getSeeds(sepDist);
+// Adds a level finer than the current finest level
+void SeedingEngine::addLevel() {
 
-			for (const Eigen::Vector3d& seed : seeds) {
+	size_t i = streamlines.size();
+	double sepDist = baseSepDist * sepScale * pow(0.8, i);
 
-				// Do not use seed if it is too close to other lines
-				if (!vg.testPoint(seed)) {
-					continue;
+	streamlines.push_back(std::vector<Streamline>());
+	sepDists.push_back(sepDist);
+	minLengths.push_back(baseMinLength * pow(0.8, i));
+
+	// Grid of a level holds the points of all levels up to and including it
+	grids.push_back(VoxelGrid(mbarsToAbs(1.0) + 100.0, sepDist));
+	for (size_t j = 0; j < i; j++) {
+		for (const Streamline& s : streamlines[j]) {
+			for (const Eigen::Vector3d& p : s.getPoints()) {
+				grids[i].addPoint(p);
+			}
+		}
+	}
+	seedLevel(i);
+	if (!headless) {
+		buildRenderables(streamlines[i]);
+	}
+	std::cout << i << " done" << std::endl;
+}
+
+
+// Seeds a level until no more lines fit. Existing lines are kept so this only fills gaps
+// With tiled seeding the globe is split into tiles that are seeded in parallel. Tiles of the same colour are far
+// enough apart that their lines can not come within the seperation distance of each other, so all tiles of one colour
+// are seeded at once against the level's grid and merged in tile order before the next colour. Seeds that fall in
+// other tiles wait for the next round. The result depends only on the tile layout, not on thread timing. Lines end
+// at the edge of their tile's halo, so they are shorter than lines seeded one at a time
+//
+// i - level to seed
+void SeedingEngine::seedLevel(size_t i) {
+
+	// Need a starting streamline to seed off of. Fields holding only a region start from its centre
+	if (i == 0 && streamlines[0].empty()) {
+		Eigen::Vector3d firstSeed(0.0, 1.0, 999.0);
+		if (!field.inDomain(firstSeed)) {
+			firstSeed = field.domainCentre();
+		}
+		std::optional<Streamline> first = fieldForSep(sepDists[0]).streamline(firstSeed, 10000000.0, 1000.0, 10000.0, grids[0]);
+		if (first) {
+			addLine(0, *first);
+		}
+	}
+
+	// Lines of neighbouring tiles could conflict if the halo and seperation do not fit between tiles
+	if (!tiledSeeding || !seedTilesFit(sepDists[i])) {
+		seedLevelSerial(i);
+		return;
+	}
+
+	std::vector<std::vector<Eigen::Vector3d>> pending(numSeedTiles());
+	for (size_t j = 0; j <= i; j++) {
+		for (const Streamline& s : streamlines[j]) {
+			for (const Eigen::Vector3d& seed : s.getSeeds(sepDists[i])) {
+				pending[seedTileOf(seed)].push_back(seed);
+			}
+		}
+	}
+
+	// Seed until you can't seed no more
+	bool seedsLeft = true;
+	while (seedsLeft) {
+
+		std::vector<std::vector<Eigen::Vector3d>> seeds(pending.size());
+		std::swap(seeds, pending);
+
+		for (int colour = 0; colour < numSeedColours; colour++) {
+
+			std::vector<int> tiles;
+			for (int t = 0; t < numSeedTiles(); t++) {
+				if (seedTileColour(t) == colour && !seeds[t].empty()) {
+					tiles.push_back(t);
 				}
+			}
 
-				// Integrate streamline and add it if it was long enough
-				Streamline newLine = field.streamline(cartToSph(seed), 10000000.0, 1000.0, 10000.0, vg);
+			std::vector<std::vector<Streamline>> newLines(tiles.size());
+			std::vector<std::vector<Eigen::Vector3d>> outSeeds(tiles.size());
+			std::vector<size_t> indices(tiles.size());
+			std::iota(indices.begin(), indices.end(), 0);
 
-				if (newLine.getTotalLength() > minLength) {
+			std::for_each(std::execution::par, indices.begin(), indices.end(), [&](size_t k) {
+				newLines[k] = seedTile(i, tiles[k], seeds[tiles[k]], outSeeds[k]);
+			});
 
-					for (const Eigen::Vector3d& p : newLine.getPoints()) {
-						vg.addPoint(p);
-					}
-					seedLines.push(newLine);
-					newLine.createRenderable(col1, col2);
-					streamlines[i].push_back(newLine);
+			for (size_t k = 0; k < tiles.size(); k++) {
+				for (Streamline& line : newLines[k]) {
+					addLine(i, line);
+				}
+				for (const Eigen::Vector3d& seed : outSeeds[k]) {
+					pending[seedTileOf(seed)].push_back(seed);
 				}
 			}
 		}
-		std::cout << i << " done" << std::endl;
+
+		seedsLeft = std::any_of(pending.begin(), pending.end(), [](const std::vector<Eigen::Vector3d>& v) { return !v.empty(); });
 	}
 }
 
 
-// Get set of streamlines that should be rendered based on camera distance and view frustum
+// Seeds a level one line at a time. Used unless tiled seeding is on and the seperation fits between tiles
 //
-// f - view frustum for culling
-// cameraDist - distance to camera for determining the resolution of lines to show (currently not used and this is done manually)
-std::vector<Renderable*> SeedingEngine::getLinesToRender(const Frustum& f, double cameraDist) {
+// i - level to seed
+void SeedingEngine::seedLevelSerial(size_t i) {
 
-	if (updateCols) {
+	VoxelGrid& vg = grids[i];
+	const SphericalVectorField& levelField = fieldForSep(sepDists[i]);
 
-		for (std::vector<Streamline>& v : streamlines) {
-			for (Streamline& s : v) {
-				s.createRenderable(col1, (bothCols) ? col2 : col1);
+	// (level, index) of lines to seed off of. Indices stay valid as lines are added
+	std::queue<std::pair<size_t, size_t>> seedLines;
+
+	for (size_t j = 0; j <= i; j++) {
+		for (size_t k = 0; k < streamlines[j].size(); k++) {
+			seedLines.push(std::pair<size_t, size_t>(j, k));
+		}
+	}
+
+	// Seed until you can't seed no more
+	while (!seedLines.empty()) {
+
+		std::pair<size_t, size_t> seedLine = seedLines.front();
+		seedLines.pop();
+
+		std::vector<Eigen::Vector3d> seeds = streamlines[seedLine.first][seedLine.second].getSeeds(sepDists[i]);
+
+		for (const Eigen::Vector3d& seed : seeds) {
+
+			// Do not use seed if it is too close to other lines
+			if (!vg.testPoint(seed)) {
+				continue;
+			}
+
+			// Integrate streamline and add it if it was long enough
+			std::optional<Streamline> newLine = levelField.streamline(cartToSph(seed), 10000000.0, 1000.0, 10000.0, vg, minLengths[i]);
+
+			if (newLine) {
+				addLine(i, *newLine);
+				seedLines.push(std::pair<size_t, size_t>(i, streamlines[i].size() - 1));
+			}
+		}
+	}
+}
+
+
+// Seeds lines from a list of seeds inside one tile. Lines are tested against the level's grid, which is not changed,
+// and against a grid of the tile's own new lines. Lines stop at the edge of the tile's halo. Seeds of new lines that
+// fall in this tile are used right away, the rest are returned. Called in parallel for tiles of the same colour
+//
+// i - level being seeded
+// t - tile to seed
+// seeds - seeds that fall inside the tile
+// outSeeds - seeds of new lines that fall in other tiles are added to this
+// return - new lines in tile
+std::vector<Streamline> SeedingEngine::seedTile(size_t i, int t, const std::vector<Eigen::Vector3d>& seeds,
+                                                std::vector<Eigen::Vector3d>& outSeeds) const {
+
+	VoxelGrid vg = seedTileGrid(i, t);
+	const SphericalVectorField& levelField = fieldForSep(sepDists[i]);
+	std::deque<Eigen::Vector3d> tileSeeds(seeds.begin(), seeds.end());
+
+	std::vector<Streamline> newLines;
+	while (!tileSeeds.empty()) {
+
+		Eigen::Vector3d seed = tileSeeds.front();
+		tileSeeds.pop_front();
+
+		if (!vg.testPoint(seed)) {
+			continue;
+		}
+
+		std::optional<Streamline> newLine = levelField.streamline(cartToSph(seed), 10000000.0, 1000.0, 10000.0, vg, minLengths[i]);
+		if (!newLine) {
+			continue;
+		}
+
+		for (const Eigen::Vector3d& p : newLine->getPoints()) {
+			vg.addPoint(p);
+		}
+		for (const Eigen::Vector3d& s : newLine->getSeeds(sepDists[i])) {
+			if (seedTileOf(s) == t) {
+				tileSeeds.push_back(s);
 			}
+			else {
+				outSeeds.push_back(s);
+			}
+		}
+		newLines.push_back(std::move(*newLine));
+	}
+	return newLines;
+}
+
+
+// Number of seeding tiles. Two polar caps followed by the rows of the band between them
+int SeedingEngine::numSeedTiles() const {
+	return 2 + numSeedBandRows() * numSeedLngTiles();
+}
+
+
+// Tile that a point is in
+//
+// p - point in cartesian
+// return - tile index
+int SeedingEngine::seedTileOf(const Eigen::Vector3d& p) const {
+
+	double tileRad = seedTileDeg * M_PI / 180.0;
+	double capRad = seedCapDeg * M_PI / 180.0;
+
+	Eigen::Vector2d latLng = cartToLatLng(p);
+	if (latLng.x() < -capRad) {
+		return 0;
+	}
+	else if (latLng.x() >= capRad) {
+		return 1;
+	}
+	int row = std::min((int)((latLng.x() + capRad) / tileRad), numSeedBandRows() - 1);
+	int col = std::min((int)(latLng.y() / tileRad), numSeedLngTiles() - 1);
+
+	return 2 + row * numSeedLngTiles() + col;
+}
+
+
+// Colour of a tile. Band tiles form a checkerboard of four colours so no two neighbours, including diagonal ones and
+// across the date line, share a colour. The polar caps touch every tile in their neighbouring row and get their own
+//
+// t - tile index
+// return - colour in [0, numSeedColours)
+int SeedingEngine::seedTileColour(int t) const {
+
+	if (t < 2) {
+		return 4;
+	}
+	int row = (t - 2) / numSeedLngTiles();
+	int col = (t - 2) % numSeedLngTiles();
+
+	return (row % 2) * 2 + (col % 2);
+}
+
+
+// Creates the grid for seeding inside a tile. Its bounds are the tile grown by the halo
+//
+// i - level being seeded
+// t - tile index
+// return - tile grid layered on the level's grid
+VoxelGrid SeedingEngine::seedTileGrid(size_t i, int t) const {
+
+	double tileRad = seedTileDeg * M_PI / 180.0;
+	double capRad = seedCapDeg * M_PI / 180.0;
+	double haloLat = seedHaloM / RADIUS_EARTH_M;
+
+	if (t == 0) {
+		return VoxelGrid(grids[i], -M_PI_2, -capRad + haloLat, 0.0, 2.0 * M_PI);
+	}
+	else if (t == 1) {
+		return VoxelGrid(grids[i], capRad - haloLat, M_PI_2, 0.0, 2.0 * M_PI);
+	}
+	int row = (t - 2) / numSeedLngTiles();
+	int col = (t - 2) % numSeedLngTiles();
+
+	double minLat = -capRad + row * tileRad - haloLat;
+	double maxLat = minLat + tileRad + 2.0 * haloLat;
+
+	// Halo is the same distance east and west at the poleward edge, and wider towards the equator
+	double haloLng = seedHaloM / (RADIUS_EARTH_M * cos(std::max(fabs(minLat), fabs(maxLat))));
+	double minLng = fmod(col * tileRad - haloLng + 2.0 * M_PI, 2.0 * M_PI);
+	double maxLng = fmod((col + 1) * tileRad + haloLng, 2.0 * M_PI);
+
+	return VoxelGrid(grids[i], minLat, maxLat, minLng, maxLng);
+}
+
+
+// Tests if tiles of the same colour are far enough apart for a seperation distance. Lines of both tiles can reach
+// into the tile between them by the halo, and still need to be the seperation distance apart
+//
+// sepDist - seperation distance of level
+// return - true if level can be seeded with tiles
+bool SeedingEngine::seedTilesFit(double sepDist) const {
+
+	double tileRad = seedTileDeg * M_PI / 180.0;
+	double capRad = seedCapDeg * M_PI / 180.0;
+	double haloLat = seedHaloM / RADIUS_EARTH_M;
+
+	// Tiles are narrowest at the poleward edge of the band's halo
+	double minGap = tileRad * RADIUS_EARTH_M * cos(capRad + haloLat);
+	return 2.0 * seedHaloM + sepDist <= minGap;
+}
+
+
+// Adds line to a level and to the grids of that level and all finer levels
+//
+// i - level to add line to
+// line - line to add
+void SeedingEngine::addLine(size_t i, Streamline& line) {
+
+	for (size_t j = i; j < grids.size(); j++) {
+		for (const Eigen::Vector3d& p : line.getPoints()) {
+			grids[j].addPoint(p);
+		}
+	}
+	streamlines[i].push_back(std::move(line));
+}
+
+
+// Builds geometry for every line in the list that does not have it yet. Lines are independent so this runs in parallel
+//
+// lines - lines to build geometry for
+void SeedingEngine::buildRenderables(std::vector<Streamline>& lines) {
+	std::for_each(std::execution::par, lines.begin(), lines.end(), [](Streamline& s) {
+		if (s.getRender() == nullptr) {
+			s.createRenderable();
+		}
+	});
+}
+
+
+// Largest field cell any level can be integrated on, so a field only builds the pyramid levels that will be used.
+// The first level has the widest seperation
+//
+// sepScale - largest seperation scale that will be seeded
+// return - cell size as distance between latitudes on the surface in metres
+double SeedingEngine::maxCellM(float sepScale) {
+	return baseSepDist * sepScale / pyramidCellsPerSep;
+}
+
+
+// Field to integrate lines with a given seperation on. Wide seperations only need large scale structure, so they use
+// a downsampled copy of the field which is much smaller to interpolate in
+//
+// sepDist - seperation distance of lines
+// return - field or one of its pyramid levels
+const SphericalVectorField& SeedingEngine::fieldForSep(double sepDist) const {
+	return field.coarsest(sepDist / pyramidCellsPerSep);
+}
+
+
+// Starts background refinement thread
+void SeedingEngine::startRefinement() {
+	stopRefine = false;
+	refineThread = std::thread(&SeedingEngine::refineLoop, this);
+}
+
+
+// Stops background refinement thread and discards refined tiles since they depend on the global levels
+void SeedingEngine::stopRefinement() {
+
+	if (refineThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(refineMutex);
+			stopRefine = true;
+		}
+		refineCV.notify_all();
+		refineThread.join();
+	}
+
+	for (auto& tile : refinedTiles) {
+		for (Streamline& s : tile.second) {
+			s.deleteRenderable();
 		}
+	}
+	refinedTiles.clear();
+	refineQueue.clear();
+	refineRequested.clear();
+}
+
+
+// Get set of streamlines that should be rendered based on distance from the camera and view frustum
+// Finer levels are only shown for lines close enough that the level's seperation is at least lineSpacingPx on screen.
+// This is done per line, so oblique views show fine levels in the foreground and coarse levels near the horizon
+//
+// f - view frustum for culling and determining screen space line spacing
+std::vector<Renderable*> SeedingEngine::getLinesToRender(const Frustum& f) {
+
+	// Colour changes only update the ramp on the GPU
+	if (updateCols) {
+		RenderEngine::setColourRamp(colourRamp());
 		updateCols = false;
 	}
 
-	std::vector<Streamline> linesR;
+	// Transparency is order independent in the render engine so no sorting is needed
+	std::vector<Renderable*> toReturn;
+
+	// No line can be closer to the eye than this along the view direction
+	double minDepth = f.minDepthOfSphere(mbarsToAbs(1.0));
 
-	int i = 1;
-	for (const std::vector<Streamline>& v : streamlines) {
+	for (size_t i = 0; i < streamlines.size(); i++) {
 
-		// Determine if this resolution of lines should be shown
-		if (i <= showLevels) {
-			for (const Streamline& s : v) {
-				if (f.overlap(s.getPoints())) {
-					linesR.push_back(s);
-				}
+		// Furthest distance this resolution of lines should be shown at. Coarsest level is always shown
+		double maxDist = std::numeric_limits<double>::max();
+		if (autoLevels && i > 0) {
+			maxDist = f.maxDistForPixelSize(sepDists[i], lineSpacingPx);
+
+			// Level is too fine everywhere in view. Finer levels will be as well
+			if (maxDist < minDepth) {
+				break;
 			}
 		}
-		else {
+		else if (!autoLevels && (int)i >= showLevels) {
 			break;
 		}
-		i++;
+
+		for (Streamline& s : streamlines[i]) {
+			if (f.overlap(s.getPoints(), maxDist)) {
+				toReturn.push_back(s.getRender());
+			}
+		}
+	}
+
+	// Levels finer than the global ones are seeded per tile in the background. Show what is ready and request the rest
+	if (autoLevels && !sepDists.empty()) {
+
+		std::lock_guard<std::mutex> lock(refineMutex);
+		for (int k = 0; k < maxRefineLevels; k++) {
+
+			double maxDist = f.maxDistForPixelSize(refineSepDist(k), lineSpacingPx);
+			if (maxDist < minDepth) {
+				break;
+			}
+
+			for (const TileKey& t : tilesInView(f, k, maxDist)) {
+
+				auto it = refinedTiles.find(t);
+				if (it == refinedTiles.end()) {
+
+					// Refinement builds on the previous level of the same tile
+					if (k == 0 || refinedTiles.count(TileKey(k - 1, std::get<1>(t), std::get<2>(t)))) {
+						requestTile(t);
+					}
+					continue;
+				}
+				for (Streamline& s : it->second) {
+					if (f.overlap(s.getPoints(), maxDist)) {
+						toReturn.push_back(s.getRender());
+					}
+				}
+			}
+		}
 	}
+	return toReturn;
+}
+
+
+// Builds the colour ramp used for lines from surface to top of the field. Interpolates the colours in Lab space
+//
+// return - list of colours from low to high altitude
+std::vector<glm::u8vec3> SeedingEngine::colourRamp() const {
 
-	// Sort for transparency. Not perfect but drastically reduces number of errors
-	auto compAvgAlt = [](const Streamline& before, const Streamline& after) {
-		double bAvgAlt = before.getSumAlt() / before.size();
-		double aAvgAlt = after.getSumAlt() / after.size();
+	glm::vec3 c2 = (bothCols) ? col2 : col1;
+	ColorSpace::Rgb lowRGB(255.0 * col1.x, 255.0 * col1.y, 255.0 * col1.z);
+	ColorSpace::Rgb highRGB(255.0 * c2.x, 255.0 * c2.y, 255.0 * c2.z);
 
-		return bAvgAlt > aAvgAlt;
+	std::vector<glm::u8vec3> ramp(colourRampSize);
+	ColorSpace::LabRamp::Build(&lowRGB, &highRGB, ramp.size(), &ramp[0].x);
+	return ramp;
+}
+
+
+// Seperation distance of a regional refinement level
+//
+// k - refinement level, 0 is the first level finer than the global ones
+// return - seperation distance in meters
+double SeedingEngine::refineSepDist(int k) const {
+	return sepDists.back() * pow(0.8, k + 1);
+}
+
+
+// Minimum line length of a regional refinement level
+//
+// k - refinement level, 0 is the first level finer than the global ones
+// return - minimum length in meters
+double SeedingEngine::refineMinLength(int k) const {
+	return minLengths.back() * pow(0.8, k + 1);
+}
+
+
+// Finds refinement tiles the view is looking at closer than the provided distance
+//
+// f - view frustum
+// k - refinement level of tiles
+// maxDist - maximum depth from the eye along the view direction
+// return - list of tiles in view
+std::vector<SeedingEngine::TileKey> SeedingEngine::tilesInView(const Frustum& f, int k, double maxDist) const {
+
+	double tileRad = refineTileDeg * M_PI / 180.0;
+	int numLngTiles = (int)(360.0 / refineTileDeg);
+	int numLatTiles = (int)(180.0 / refineTileDeg);
+
+	std::set<TileKey> tiles;
+	for (const Eigen::Vector3d& p : f.groundPoints(9, maxDist)) {
+
+		Eigen::Vector2d latLng = cartToLatLng(p);
+		int latI = std::min((int)((latLng.x() + M_PI_2) / tileRad), numLatTiles - 1);
+		int lngI = std::min((int)(latLng.y() / tileRad), numLngTiles - 1);
+
+		tiles.insert(TileKey(k, latI, lngI));
+	}
+	return std::vector<TileKey>(tiles.begin(), tiles.end());
+}
+
+
+// Queue tile for background refinement if it has not been already. Caller must hold refineMutex
+//
+// t - tile to refine
+void SeedingEngine::requestTile(const TileKey& t) {
+
+	if (refineRequested.insert(t).second) {
+
+		// Most recent requests first since they are most likely still in view
+		refineQueue.push_front(t);
+		refineCV.notify_one();
+	}
+}
+
+
+// Background loop that refines requested tiles until the engine is destroyed
+void SeedingEngine::refineLoop() {
+
+	while (true) {
+
+		TileKey t;
+		{
+			std::unique_lock<std::mutex> lock(refineMutex);
+			refineCV.wait(lock, [this]() { return stopRefine || !refineQueue.empty(); });
+			if (stopRefine) {
+				return;
+			}
+			t = refineQueue.front();
+			refineQueue.pop_front();
+		}
+
+		std::vector<Streamline> lines = refineTile(t);
+
+		std::lock_guard<std::mutex> lock(refineMutex);
+		refinedTiles[t] = std::move(lines);
+	}
+}
+
+
+// Seeds one refinement level inside a tile. Lines respect all coarser lines and neighbouring refined tiles,
+// and are stopped at the edge of the tile's halo. Runs on the refinement thread
+//
+// t - tile to refine
+// return - new lines in tile
+std::vector<Streamline> SeedingEngine::refineTile(const TileKey& t) {
+
+	// Global levels can not change while a tile is built from them
+	std::shared_lock<std::shared_mutex> levelsLock(levelsMutex);
+
+	int k = std::get<0>(t);
+	double tileRad = refineTileDeg * M_PI / 180.0;
+	double haloRad = refineHaloDeg * M_PI / 180.0;
+
+	double minLat = -M_PI_2 + std::get<1>(t) * tileRad;
+	double maxLat = minLat + tileRad;
+	double minLng = std::get<2>(t) * tileRad;
+	double maxLng = minLng + tileRad;
+
+	double sepDist = refineSepDist(k);
+	double minLength = refineMinLength(k);
+
+	VoxelGrid vg(mbarsToAbs(1.0) + 100.0, sepDist);
+	vg.setBounds(minLat - haloRad, maxLat + haloRad, fmod(minLng - haloRad + 2.0 * M_PI, 2.0 * M_PI), fmod(maxLng + haloRad, 2.0 * M_PI));
+
+	// Seed off of every existing line that passes near the tile
+	std::queue<const Streamline*> seedLines;
+	auto addLines = [&](const std::vector<Streamline>& lines) {
+		for (const Streamline& s : lines) {
+
+			bool near = false;
+			for (const Eigen::Vector3d& p : s.getPoints()) {
+				if (vg.inBounds(p)) {
+					vg.addPoint(p);
+					near = true;
+				}
+			}
+			if (near) {
+				seedLines.push(&s);
+			}
+		}
 	};
-	std::sort(linesR.begin(), linesR.end(), compAvgAlt);
+	for (const std::vector<Streamline>& v : streamlines) {
+		addLines(v);
+	}
 
-	// Make list of respective renderables
-	std::vector<Renderable*> toReturn;
-	for (Streamline& s : linesR) {
-		toReturn.push_back(s.getRender());
+	// Only this thread adds tiles, so reading them without the lock is safe
+	for (const auto& tile : refinedTiles) {
+		if (std::get<0>(tile.first) <= k) {
+			addLines(tile.second);
+		}
 	}
 
-	return toReturn;
+	// Deque so that references in seedLines stay valid as lines are added
+	std::deque<Streamline> newLines;
+	while (!seedLines.empty() && !stopRefine) {
+
+		const Streamline* seedLine = seedLines.front();
+		seedLines.pop();
+
+		for (const Eigen::Vector3d& seed : seedLine->getSeeds(sepDist)) {
+
+			// Seeds must be inside the tile itself, halo seeds belong to the neighbour
+			Eigen::Vector2d latLng = cartToLatLng(seed);
+			if (latLng.x() < minLat || latLng.x() >= maxLat || latLng.y() < minLng || latLng.y() >= maxLng) {
+				continue;
+			}
+			if (!vg.testPoint(seed)) {
+				continue;
+			}
+
+			std::optional<Streamline> newLine = fieldForSep(sepDist).streamline(cartToSph(seed), 10000000.0, 1000.0, 10000.0, vg, minLength);
+			if (newLine) {
+
+				for (const Eigen::Vector3d& p : newLine->getPoints()) {
+					vg.addPoint(p);
+				}
+				newLines.push_back(std::move(*newLine));
+				seedLines.push(&newLines.back());
+			}
+		}
+	}
+	std::vector<Streamline> lines(newLines.begin(), newLines.end());
+	buildRenderables(lines);
+	return lines;
 }
\ No newline at end of file
@@ -1,11 +1,20 @@
 #pragma once
 
 #include "Streamline.h"
+#include "VoxelGrid.h"
 
 class Frustum;
 class SphericalVectorField;
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 
@@ -13,23 +22,108 @@ class SphericalVectorField;
 class SeedingEngine {
 
 public:
-	SeedingEngine(SphericalVectorField& field);
+	// Largest seperation scale the window allows
+	static constexpr float maxSepScale = 2.f;
+
+	SeedingEngine(SphericalVectorField& field, bool headless = false);
+	~SeedingEngine();
+
+	static double maxCellM(float sepScale);
 
 	void seed();
-	std::vector<Renderable*> getLinesToRender(const Frustum& f, double cameraDist);
+	void setSeedingParams(int levels, float scale);
+	void setTiledSeeding(bool tiled) { tiledSeeding = tiled; }
+	void applySeedingChanges();
+	const std::vector<std::vector<Streamline>>& getStreamlines() const { return streamlines; }
+	std::vector<Renderable*> getLinesToRender(const Frustum& f);
 
 	void ImGui();
 
 private:
+	// (refinement level, lat index, long index) of a refinement tile
+	typedef std::tuple<int, int, int> TileKey;
+
+	static constexpr double baseSepDist = 200000.0;
+	static constexpr double baseMinLength = 1000000.0;
+
+	// Levels are integrated on the coarsest field pyramid level with at least this many cells per seperation
+	static constexpr double pyramidCellsPerSep = 2.0;
+
+	static constexpr size_t colourRampSize = 256;
+
+	// Tiles for parallel seeding. Caps cover the poles above seedCapDeg, band between them is split into square tiles
+	static constexpr double seedTileDeg = 15.0;
+	static constexpr double seedCapDeg = 60.0;
+	static constexpr double seedHaloM = 250000.0;
+	static constexpr int numSeedColours = 5;
+
+	static constexpr int maxRefineLevels = 2;
+	static constexpr double refineTileDeg = 10.0;
+	static constexpr double refineHaloDeg = 2.0;
+
 	SphericalVectorField& field;
+	bool headless;
+
+	// Tiles are seeded in parallel but lines stop at the edge of a tile's halo, so they come out shorter. Off by default
+	bool tiledSeeding;
 	std::vector<std::vector<Streamline>> streamlines;
+	std::vector<double> sepDists;
+	std::vector<double> minLengths;
+	std::vector<VoxelGrid> grids;
+
+	// Guards the levels above. Refinement reads them under a shared lock, seeding changes them under an exclusive one
+	std::shared_mutex levelsMutex;
+
+	// Regional refinement seeded on demand by a background thread. Mutex guards the tiles and queue
+	std::map<TileKey, std::vector<Streamline>> refinedTiles;
+	std::deque<TileKey> refineQueue;
+	std::set<TileKey> refineRequested;
+	std::mutex refineMutex;
+	std::condition_variable refineCV;
+	std::thread refineThread;
+	std::atomic<bool> stopRefine;
 
 	int numLevels;
 	int showLevels;
 
+	float sepScale;
+	int targetLevels;
+	float targetSepScale;
+
+	bool autoLevels;
+	float lineSpacingPx;
+
 	bool updateCols;
 	bool bothCols;
 	glm::vec3 col1;
 	glm::vec3 col2;
+
+	void addLevel();
+	void seedLevel(size_t i);
+	void seedLevelSerial(size_t i);
+	std::vector<Streamline> seedTile(size_t i, int t, const std::vector<Eigen::Vector3d>& seeds,
+	                                 std::vector<Eigen::Vector3d>& outSeeds) const;
+	void addLine(size_t i, Streamline& line);
+	void buildRenderables(std::vector<Streamline>& lines);
+	const SphericalVectorField& fieldForSep(double sepDist) const;
+
+	int numSeedLngTiles() const { return (int)(360.0 / seedTileDeg); }
+	int numSeedBandRows() const { return (int)(2.0 * seedCapDeg / seedTileDeg); }
+	int numSeedTiles() const;
+	int seedTileOf(const Eigen::Vector3d& p) const;
+	int seedTileColour(int t) const;
+	VoxelGrid seedTileGrid(size_t i, int t) const;
+	bool seedTilesFit(double sepDist) const;
+
+	std::vector<glm::u8vec3> colourRamp() const;
+
+	void startRefinement();
+	void stopRefinement();
+	double refineSepDist(int k) const;
+	double refineMinLength(int k) const;
+	std::vector<TileKey> tilesInView(const Frustum& f, int k, double maxDist) const;
+	void requestTile(const TileKey& t);
+	void refineLoop();
+	std::vector<Streamline> refineTile(const TileKey& t);
 };
 
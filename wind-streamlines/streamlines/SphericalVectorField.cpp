@@ -1,70 +1,464 @@
 #include "SphericalVectorField.h"
 
+#include "BrickCache.h"
 #include "Conversions.h"
 #include "Streamline.h"
 #include "VoxelGrid.h"
 
+#include <algorithm>
+#include <execution>
+#include <future>
+#include <numeric>
+
+
+std::mutex SphericalVectorField::netCDFMutex;
+
+
+// Construct empty vector field
+SphericalVectorField::SphericalVectorField() {
+	pickAccessors();
+}
+
 
 // Construct vector field from data provided in NetCDF file
-// Assumes data is of a certain format, does not work for general files
+// Assumes data is of a certain format, does not work for general files. Only grid points inside the subset are read,
+// though each dimension keeps at least two points so there is always a cell to interpolate in
 //
 // file - NetCDF file containing ERA5 wind data (u, v, w) at all levels at one time slice
-SphericalVectorField::SphericalVectorField(const netCDF::NcFile& file) : 
-	data(NUM_LONGS * NUM_LATS * NUM_LEVELS),
-	levels(NUM_LEVELS), 
-	lats(NUM_LATS),
-	longs(NUM_LONGS) {
+// subset - region, levels, and decimation to load
+// layout - order of points in memory
+// maxCellM - largest cell a caller will integrate on, see coarsest. Pyramid levels are only built up to this size
+SphericalVectorField::SphericalVectorField(const netCDF::NcFile& file, const FieldSubset& subset, FieldLayout layout,
+                                           double maxCellM) {
+
+	FileGrid g = openGrid(file, subset);
+	initLayout(layout);
+
+	// Read a slab of whole levels at a time, as deep as the file's chunks so each chunk is only decompressed once
+	size_t slabLevels = std::min(g.chunkLevels, numLevels);
+	size_t levelSize = numLats * numLongs;
+
+	// Raw packed values, double buffered so one slab is decoded while the next is read
+	std::vector<short> raw[2][3];
+	size_t runCount[2][2];
+	for (int b = 0; b < 2; b++) {
+		for (int c = 0; c < 3; c++) {
+			raw[b][c].resize(slabLevels * levelSize);
+		}
+	}
+
+	// Rows of a slab are decoded in parallel straight into data
+	std::vector<size_t> rows(slabLevels * numLats);
+	std::iota(rows.begin(), rows.end(), 0);
+
+	auto decodeSlab = [&](size_t lvl, size_t numLvls, int b) {
+		size_t numRows = numLvls * numLats;
 
-	// Get values for levels, latitude, and longitude
-	file.getVar("level").getVar(levels.data());
-	file.getVar("latitude").getVar(lats.data());
-	file.getVar("longitude").getVar(longs.data());
+		std::for_each(std::execution::par, rows.begin(), rows.begin() + numRows, [&](size_t row) {
+			size_t lat = row % numLats;
+			size_t rowLvl = lvl + row / numLats;
 
-	// Convert from degrees to radians
-	for (size_t i = 0; i < NUM_LATS; i++) {
-		lats[i] *= (M_PI / 180.0);
+			if (layout == FieldLayout::Linear) {
+				decodeRow(g, raw[b], runCount[b], numRows, row, &data[indexToOffset(lat, 0, rowLvl)]);
+			}
+			else {
+				// Row is spread over the bricks it crosses
+				thread_local std::vector<Eigen::Vector3d> rowData;
+				rowData.resize(numLongs);
+				decodeRow(g, raw[b], runCount[b], numRows, row, rowData.data());
+				for (size_t lng = 0; lng < numLongs; lng++) {
+					data[indexToOffset(lat, lng, rowLvl)] = rowData[lng];
+				}
+			}
+		});
+	};
+
+	std::future<void> decoding;
+	int b = 0;
+	for (size_t lvl = 0; lvl < numLevels; lvl += slabLevels) {
+
+		size_t numLvls = std::min(slabLevels, numLevels - lvl);
+		readRegion(g, lvl, numLvls, 0, numLats, 0, numLongs, raw[b], runCount[b]);
+
+		if (decoding.valid()) {
+			decoding.get();
+		}
+		decoding = std::async(std::launch::async, decodeSlab, lvl, numLvls, b);
+		b = 1 - b;
+	}
+	decoding.get();
+
+	// Each pyramid level needs at least two latitudes and longitudes, and levels coarser than maxCellM are never used
+	const SphericalVectorField* fine = this;
+	for (int k = 0; k < NUM_PYRAMID_LEVELS && fine->numLats > 2 && fine->numLongs > 2 &&
+	     RADIUS_EARTH_M / (0.5 * fine->latsPerRad) <= maxCellM; k++) {
+		pyramid.push_back(std::make_unique<SphericalVectorField>(fine->downsample()));
+		fine = pyramid.back().get();
+	}
+}
+
+
+// Construct vector field that reads data from a NetCDF file on demand, for fields too large to hold in memory.
+// Bricks of the field are kept in a cache of bounded size. No pyramid is built since that would need every brick
+//
+// path - path of NetCDF file containing ERA5 wind data (u, v, w) at all levels at one time slice
+// subset - region, levels, and decimation to load
+// cacheBytes - memory for cached data, shared by the brick cache and NetCDF's chunk caches
+SphericalVectorField::SphericalVectorField(const std::string& path, const FieldSubset& subset, size_t cacheBytes) {
+
+	// File stays open as long as the cache can load from it. The last reference can be dropped on any thread, so
+	// closing the file takes the lock like every other NetCDF call
+	netCDF::NcFile* opened;
+	{
+		std::lock_guard<std::mutex> lock(netCDFMutex);
+		opened = new netCDF::NcFile(path, netCDF::NcFile::read);
 	}
-	for (size_t i = 0; i < NUM_LONGS; i++) {
-		longs[i] *= (M_PI / 180.0);
+	std::shared_ptr<netCDF::NcFile> file(opened, [](netCDF::NcFile* f) {
+		std::lock_guard<std::mutex> lock(netCDFMutex);
+		delete f;
+	});
+	FileGrid g = openGrid(*file, subset);
+
+	// A brick read decompresses every chunk it overlaps, and chunks are usually larger than bricks. Each variable
+	// gets a chunk cache that holds the chunks of two bricks, so the next brick along a line finds the chunks it
+	// shares with the last one instead of decompressing them again. Chunk caches get at most half of the memory
+	if (g.chunkLats > 0) {
+		auto chunksOverlapped = [](size_t span, size_t chunk, size_t fileSize) {
+			return std::min((span + chunk - 2) / chunk + 1, (fileSize + chunk - 1) / chunk);
+		};
+		size_t chunks = chunksOverlapped(BrickCache::BRICK_LEVELS, g.chunkLevels, NUM_LEVELS) *
+		                chunksOverlapped(BrickCache::BRICK_LATS * g.stride, g.chunkLats, NUM_LATS) *
+		                chunksOverlapped(BrickCache::BRICK_LONGS * g.stride, g.chunkLongs, NUM_LONGS);
+		size_t chunkCacheBytes = std::min(2 * chunks * g.chunkLevels * g.chunkLats * g.chunkLongs * sizeof(short),
+		                                  cacheBytes / 6);
+
+		std::lock_guard<std::mutex> lock(netCDFMutex);
+		for (int c = 0; c < 3; c++) {
+			g.vars[c].setChunkCache(chunkCacheBytes, CHUNK_CACHE_SLOTS, 0.75f);
+		}
+		cacheBytes -= 3 * chunkCacheBytes;
 	}
 
+	size_t fieldLats = numLats;
+	size_t fieldLongs = numLongs;
+	size_t fieldLevels = numLevels;
+
+	auto loadBrick = [file, g, fieldLats, fieldLongs, fieldLevels](size_t lat, size_t lng, size_t lvl, BrickCache::Brick& brick) {
+
+		size_t numLts = std::min(BrickCache::BRICK_LATS, fieldLats - lat);
+		size_t numLngs = std::min(BrickCache::BRICK_LONGS, fieldLongs - lng);
+		size_t numLvls = std::min(BrickCache::BRICK_LEVELS, fieldLevels - lvl);
+
+		std::vector<short> raw[3];
+		size_t runCount[2];
+		for (int c = 0; c < 3; c++) {
+			raw[c].resize(numLvls * numLts * numLngs);
+		}
+		readRegion(g, lvl, numLvls, lat, numLts, lng, numLngs, raw, runCount);
+
+		size_t numRows = numLvls * numLts;
+		for (size_t row = 0; row < numRows; row++) {
+			size_t brickRow = (row / numLts) * BrickCache::BRICK_LATS + row % numLts;
+			decodeRow(g, raw, runCount, numRows, row, brick.data() + brickRow * BrickCache::BRICK_LONGS);
+		}
+	};
+	bricks = std::make_shared<BrickCache>(numLats, numLongs, numLevels, cacheBytes, loadBrick);
+	pickAccessors();
+}
+
+
+// Sets order of points in memory and sizes data to match. Bricked layout pads the field to whole bricks
+//
+// newLayout - order of points
+void SphericalVectorField::initLayout(FieldLayout newLayout) {
+
+	layout = newLayout;
+	latBricks = (numLats + 3) / 4;
+	longBricks = (numLongs + 3) / 4;
+
+	size_t levelBricks = (numLevels + 3) / 4;
+	data.resize((layout == FieldLayout::Linear) ? numLevels * numLats * numLongs : 64 * latBricks * longBricks * levelBricks);
+	pickAccessors();
+}
+
+
+// Picks index conversions and velocity lookup for the layout of the field, and for whether it is read through a
+// brick cache. Lookups then call the right version directly instead of checking on every corner
+void SphericalVectorField::pickAccessors() {
+
+	if (layout == FieldLayout::Linear) {
+		indexToOffsetFn = &SphericalVectorField::layoutOffset<FieldLayout::Linear>;
+		offsetToIndexFn = &SphericalVectorField::layoutIndex<FieldLayout::Linear>;
+		velocityAtFn = &SphericalVectorField::velocityAtStorage<Storage::Linear>;
+	}
+	else {
+		indexToOffsetFn = &SphericalVectorField::layoutOffset<FieldLayout::Bricked>;
+		offsetToIndexFn = &SphericalVectorField::layoutIndex<FieldLayout::Bricked>;
+		velocityAtFn = &SphericalVectorField::velocityAtStorage<Storage::Bricked>;
+	}
+	if (bricks) {
+		velocityAtFn = &SphericalVectorField::velocityAtStorage<Storage::Cached>;
+	}
+}
+
+
+// Returns position of an absolute index in linear (level, lat, long) order
+//
+// i - absolute 1D index
+// return - linear index
+size_t SphericalVectorField::linearIndex(size_t i) const {
+
+	if (layout == FieldLayout::Linear) {
+		return i;
+	}
+	Eigen::Matrix<size_t, 3, 1> v = offsetToIndex(i);
+	return v.y() + numLongs * (v.x() + numLats * v.z());
+}
+
+
+// Reads coordinates of the file, works out which part of the file's grid the subset covers, and sets up coordinates
+// and sizes of the field to match
+//
+// file - NetCDF file containing ERA5 wind data
+// subset - region, levels, and decimation to load
+// return - where the field lies in the file and how to read it
+SphericalVectorField::FileGrid SphericalVectorField::openGrid(const netCDF::NcFile& file, const FieldSubset& subset) {
+
+	FileGrid g;
+	g.stride = std::clamp(subset.stride, (size_t)1, NUM_LATS - 1);
+	size_t stride = g.stride;
+
+	// Get values for levels, latitude, and longitude of whole file
+	std::vector<int> fileLevels(NUM_LEVELS);
+	std::vector<double> fileLats(NUM_LATS);
+	std::vector<double> fileLongs(NUM_LONGS);
+
+	std::lock_guard<std::mutex> lock(netCDFMutex);
+
+	file.getVar("level").getVar(fileLevels.data());
+	file.getVar("latitude").getVar(fileLats.data());
+	file.getVar("longitude").getVar(fileLongs.data());
+
+	// Levels are increasing pressure
+	g.firstLvl = 0;
+	while (g.firstLvl < NUM_LEVELS - 2 && fileLevels[g.firstLvl] < subset.minLevel) {
+		g.firstLvl++;
+	}
+	numLevels = 2;
+	while (g.firstLvl + numLevels < NUM_LEVELS && fileLevels[g.firstLvl + numLevels] <= subset.maxLevel) {
+		numLevels++;
+	}
+
+	// Latitudes are decreasing from the north pole
+	g.firstLat = 0;
+	while (g.firstLat + stride < NUM_LATS - 1 && fileLats[g.firstLat] > subset.maxLat) {
+		g.firstLat++;
+	}
+	numLats = 2;
+	while (g.firstLat + numLats * stride < NUM_LATS && fileLats[g.firstLat + numLats * stride] >= subset.minLat) {
+		numLats++;
+	}
+	clampLats = subset.maxLat >= fileLats[0] && subset.minLat <= fileLats[NUM_LATS - 1];
+
+	// Longitudes are increasing from 0 and the box may cross it
+	double fileLngSpacing = fileLongs[1] - fileLongs[0];
+	double span = subset.maxLng - subset.minLng;
+	g.firstLng = 0;
+
+	wrapLongs = span >= 360.0;
+	if (wrapLongs) {
+		numLongs = (NUM_LONGS + stride - 1) / stride;
+	}
+	else {
+		double minLng = fmod(fmod(subset.minLng, 360.0) + 360.0, 360.0);
+		span = (span < 0.0) ? span + 360.0 : span;
+
+		g.firstLng = (size_t)ceil((minLng - fileLongs[0]) / fileLngSpacing - 0.0001) % NUM_LONGS;
+		double firstLngDeg = fileLongs[0] + g.firstLng * fileLngSpacing;
+		double lngsInBox = floor((minLng + span - firstLngDeg) / (fileLngSpacing * stride) + 0.0001) + 1.0;
+		numLongs = std::clamp((size_t)std::max(lngsInBox, 0.0), (size_t)2, (NUM_LONGS - 1) / stride + 1);
+	}
+
+	// Coordinates of loaded points in radians. Longitudes keep increasing past 2pi if the box crosses 0
+	levels.resize(numLevels);
+	lats.resize(numLats);
+	longs.resize(numLongs);
+
+	for (size_t i = 0; i < numLevels; i++) {
+		levels[i] = fileLevels[g.firstLvl + i];
+	}
+	for (size_t i = 0; i < numLats; i++) {
+		lats[i] = fileLats[g.firstLat + i * stride] * (M_PI / 180.0);
+	}
+	for (size_t i = 0; i < numLongs; i++) {
+		size_t j = g.firstLng + i * stride;
+		longs[i] = (fileLongs[j % NUM_LONGS] + ((j >= NUM_LONGS) ? 360.0 : 0.0)) * (M_PI / 180.0);
+	}
+	latsPerRad = 1.0 / (stride * (fileLats[0] - fileLats[1]) * (M_PI / 180.0));
+	longsPerRad = 1.0 / (stride * fileLngSpacing * (M_PI / 180.0));
+
 	// Get wind components
-	netCDF::NcVar uVar = file.getVar("u");
-	netCDF::NcVar vVar = file.getVar("v");
-	netCDF::NcVar wVar = file.getVar("w");
+	g.vars[0] = file.getVar("u");
+	g.vars[1] = file.getVar("v");
+	g.vars[2] = file.getVar("w");
+
+	for (int c = 0; c < 3; c++) {
+		g.vars[c].getAtt("scale_factor").getValues(&g.scales[c]);
+		g.vars[c].getAtt("add_offset").getValues(&g.offsets[c]);
+	}
+
+	// u, v, and w have same dimensions. ERA5 files may have a leading time dimension of size 1
+	g.numDims = g.vars[0].getDimCount();
+
+	// Latitude and longitude chunk sizes are 0 if the file is not chunked
+	g.chunkLevels = 1;
+	g.chunkLats = 0;
+	g.chunkLongs = 0;
+	netCDF::NcVar::ChunkMode chunkMode;
+	std::vector<size_t> chunkSizes;
+	g.vars[0].getChunkingParameters(chunkMode, chunkSizes);
+	if (chunkMode == netCDF::NcVar::nc_CHUNKED && chunkSizes.size() == g.numDims) {
+		g.chunkLevels = std::max(chunkSizes[g.numDims - 3], (size_t)1);
+		g.chunkLats = std::max(chunkSizes[g.numDims - 2], (size_t)1);
+		g.chunkLongs = std::max(chunkSizes[g.numDims - 1], (size_t)1);
+	}
 
-	double uScale, vScale, wScale, uOffset, vOffset, wOffset;
+	return g;
+}
 
-	uVar.getAtt("scale_factor").getValues(&uScale);
-	vVar.getAtt("scale_factor").getValues(&vScale);
-	wVar.getAtt("scale_factor").getValues(&wScale);
-	uVar.getAtt("add_offset").getValues(&uOffset);
-	vVar.getAtt("add_offset").getValues(&vOffset);
-	wVar.getAtt("add_offset").getValues(&wOffset);
 
-	// u, v, and w have same dimensions
-	size_t size = NUM_LONGS * NUM_LATS * NUM_LEVELS;
+// Reads raw packed values of a region of the field from file. Longitudes are read in at most two runs, split where
+// the region crosses the end of the file's longitudes, and each run is a separate block of raw
+//
+// g - where the field lies in the file
+// lvl - first level index
+// numLvls - number of levels
+// lat - first latitude index
+// numLts - number of latitudes
+// lng - first longitude index
+// numLngs - number of longitudes
+// raw - u, v, and w values out. Must hold the whole region
+// runCount - number of longitudes in each run out
+void SphericalVectorField::readRegion(const FileGrid& g, size_t lvl, size_t numLvls, size_t lat, size_t numLts,
+                                      size_t lng, size_t numLngs, std::vector<short> raw[3], size_t runCount[2]) {
+
+	size_t runStart[2];
+	runStart[0] = (g.firstLng + lng * g.stride) % NUM_LONGS;
+	runCount[0] = std::min(numLngs, (NUM_LONGS - runStart[0] + g.stride - 1) / g.stride);
+	runStart[1] = (runStart[0] + runCount[0] * g.stride) % NUM_LONGS;
+	runCount[1] = numLngs - runCount[0];
+
+	size_t lvlDim = g.numDims - 3;
+	size_t runOffset = 0;
+
+	std::lock_guard<std::mutex> lock(netCDFMutex);
+	for (int r = 0; r < 2; r++) {
+		if (runCount[r] == 0) {
+			continue;
+		}
+		std::vector<size_t> start(g.numDims, 0);
+		std::vector<size_t> count(g.numDims, 1);
+		std::vector<ptrdiff_t> strides(g.numDims, 1);
+		start[lvlDim] = g.firstLvl + lvl;
+		count[lvlDim] = numLvls;
+		start[lvlDim + 1] = g.firstLat + lat * g.stride;
+		count[lvlDim + 1] = numLts;
+		strides[lvlDim + 1] = g.stride;
+		start[lvlDim + 2] = runStart[r];
+		count[lvlDim + 2] = runCount[r];
+		strides[lvlDim + 2] = g.stride;
+
+		for (int c = 0; c < 3; c++) {
+			g.vars[c].getVar(start, count, strides, raw[c].data() + runOffset);
+		}
+		runOffset += numLvls * numLts * runCount[r];
+	}
+}
 
-	double* uArry = new double[size];
-	double* vArry = new double[size];
-	double* wArry = new double[size];
 
-	uVar.getVar(uArry);
-	vVar.getVar(vArry);
-	wVar.getVar(wArry);
+// Applies scale and offset to one row of a region read by readRegion
+//
+// g - where the field lies in the file
+// raw - u, v, and w values of region
+// runCount - number of longitudes in each run
+// numRows - number of rows (levels times latitudes) in region
+// row - row to decode
+// dest - row of vectors out
+void SphericalVectorField::decodeRow(const FileGrid& g, const std::vector<short> raw[3], const size_t runCount[2],
+                                     size_t numRows, size_t row, Eigen::Vector3d* dest) {
+
+	size_t runOffset = 0;
+	for (int r = 0; r < 2; r++) {
+		size_t src = runOffset + row * runCount[r];
+		for (size_t i = 0; i < runCount[r]; i++) {
+			double u = raw[0][src + i] * g.scales[0] + g.offsets[0];
+			double v = raw[1][src + i] * g.scales[1] + g.offsets[1];
+			double w = raw[2][src + i] * g.scales[2] + g.offsets[2];
+
+			*dest++ = Eigen::Vector3d(v, u, w);
+		}
+		runOffset += numRows * runCount[r];
+	}
+}
 
-	// Apply scale and offset and add to data vector
-	for (size_t i = 0; i < size; i++) {
-		double u = uArry[i] * uScale + uOffset;
-		double v = vArry[i] * vScale + vOffset;
-		double w = wArry[i] * wScale + wOffset;
 
-		data[i] = (Eigen::Vector3d(v, u, w));
+// Returns a copy of the field with every other latitude and longitude. Each point is a 1-2-1 weighted average of its
+// neighbours in both directions so small scale structure is filtered out rather than aliased. Levels are kept. The
+// last latitude, and the last longitude of a subset, are always kept so the copy covers the same domain. With an
+// even number of points that makes the last cell half as wide
+//
+// return - downsampled field
+SphericalVectorField SphericalVectorField::downsample() const {
+
+	SphericalVectorField c;
+	c.param = param;
+	c.numLevels = numLevels;
+	c.numLats = numLats / 2 + 1;
+	c.numLongs = (wrapLongs) ? (numLongs + 1) / 2 : numLongs / 2 + 1;
+	c.wrapLongs = wrapLongs;
+	c.clampLats = clampLats;
+	c.latsPerRad = 0.5 * latsPerRad;
+	c.longsPerRad = 0.5 * longsPerRad;
+
+	c.initLayout(layout);
+
+	c.levels = levels;
+	c.lats.resize(c.numLats);
+	c.longs.resize(c.numLongs);
+	for (size_t i = 0; i < c.numLats; i++) {
+		c.lats[i] = lats[std::min(2 * i, numLats - 1)];
+	}
+	for (size_t i = 0; i < c.numLongs; i++) {
+		c.longs[i] = longs[std::min(2 * i, numLongs - 1)];
 	}
 
-	delete[] uArry;
-	delete[] vArry;
-	delete[] wArry;
+	std::vector<size_t> rows(c.numLevels * c.numLats);
+	std::iota(rows.begin(), rows.end(), 0);
+
+	std::for_each(std::execution::par, rows.begin(), rows.end(), [&](size_t row) {
+
+		size_t lvl = row / c.numLats;
+		size_t cLat = row % c.numLats;
+		size_t lat = std::min(2 * cLat, numLats - 1);
+		size_t latN = (lat > 0) ? lat - 1 : lat;
+		size_t latS = std::min(lat + 1, numLats - 1);
+
+		for (size_t i = 0; i < c.numLongs; i++) {
+
+			// Neighbours past the edge of a subset are clamped to it
+			size_t lng = std::min(2 * i, numLongs - 1);
+			size_t lngW = (wrapLongs) ? (lng + numLongs - 1) % numLongs : ((lng > 0) ? lng - 1 : lng);
+			size_t lngE = (wrapLongs) ? (lng + 1) % numLongs : std::min(lng + 1, numLongs - 1);
+
+			Eigen::Vector3d n = (*this)(latN, lngW, lvl) + 2.0 * (*this)(latN, lng, lvl) + (*this)(latN, lngE, lvl);
+			Eigen::Vector3d m = (*this)(lat, lngW, lvl) + 2.0 * (*this)(lat, lng, lvl) + (*this)(lat, lngE, lvl);
+			Eigen::Vector3d s = (*this)(latS, lngW, lvl) + 2.0 * (*this)(latS, lng, lvl) + (*this)(latS, lngE, lvl);
+
+			c.data[c.indexToOffset(cLat, i, lvl)] = (n + 2.0 * m + s) / 16.0;
+		}
+	});
+
+	return c;
 }
 
 
@@ -75,18 +469,21 @@ std::vector<std::pair<Eigen::Matrix<size_t, 3, 1>, int>> SphericalVectorField::f
 
 	std::vector<std::pair<Eigen::Matrix<size_t, 3, 1>, int>> points;
 
-	for (size_t lvl = 0; lvl < NUM_LEVELS - 1; lvl++) {
-		for (size_t lat = 0; lat < NUM_LATS - 1; lat++) {
-			for (size_t lng = 0; lng < NUM_LONGS; lng++) {
+	// Cells past the last longitude only exist if longitudes wrap around
+	size_t lngCells = (wrapLongs) ? numLongs : numLongs - 1;
+
+	for (size_t lvl = 0; lvl < numLevels - 1; lvl++) {
+		for (size_t lat = 0; lat < numLats - 1; lat++) {
+			for (size_t lng = 0; lng < lngCells; lng++) {
 
 				// 8 vertices of hexahedron
 				size_t i0 = indexToOffset(lat, lng, lvl);
 				size_t i1 = indexToOffset(lat, lng, lvl + 1);
 				size_t i2 = indexToOffset(lat + 1, lng, lvl + 1);
-				size_t i3 = indexToOffset(lat, (lng + 1) % NUM_LONGS, lvl + 1);
-				size_t i4 = indexToOffset(lat + 1, (lng + 1) % NUM_LONGS, lvl);
-				size_t i5 = indexToOffset(lat + 1, (lng + 1) % NUM_LONGS, lvl + 1);
-				size_t i6 = indexToOffset(lat, (lng + 1) % NUM_LONGS, lvl);
+				size_t i3 = indexToOffset(lat, (lng + 1) % numLongs, lvl + 1);
+				size_t i4 = indexToOffset(lat + 1, (lng + 1) % numLongs, lvl);
+				size_t i5 = indexToOffset(lat + 1, (lng + 1) % numLongs, lvl + 1);
+				size_t i6 = indexToOffset(lat, (lng + 1) % numLongs, lvl);
 				size_t i7 = indexToOffset(lat + 1, lng, lvl);
 				
 				// Construct 5 tets from hex and test each one to see if it has a critical point
@@ -134,7 +531,7 @@ int SphericalVectorField::signTet(const Eigen::Vector4d& v0, const Eigen::Vector
                                   const Eigen::Vector4d& v2, const Eigen::Vector4d& v3,
                                   size_t i0, size_t i1, size_t i2, size_t i3) const {
 	
-	// Inversion count tells us orientation of tet. Loop unwrapped
+	// Inversion count tells us orientation of tet. Loop unwrapped. Indices are in linear order whatever the layout
 	int invCount = 0;
 	if (i0 < i1) invCount++;
 	if (i0 < i2) invCount++;
@@ -165,22 +562,24 @@ int SphericalVectorField::criticalPointInTet(size_t i0, size_t i1, size_t i2, si
 
 	// Get vector field values
 	Eigen::Vector4d v0, v1, v2, v3;
-	v0 << data[i0], 1.0;
-	v1 << data[i1], 1.0;
-	v2 << data[i2], 1.0;
-	v3 << data[i3], 1.0;
+	v0 << (*this)(i0), 1.0;
+	v1 << (*this)(i1), 1.0;
+	v2 << (*this)(i2), 1.0;
+	v3 << (*this)(i3), 1.0;
 
 	// Test if tet contains critical point
 	Eigen::Vector4d zeroPoint(0.0, 0.0, 0.0, 1.0);
-	int simplexSign = signTet(zeroPoint, v1, v2, v3, i0, i1, i2, i3);
+	// Orientation needs a global order of vertices that does not depend on layout
+	size_t l0 = linearIndex(i0), l1 = linearIndex(i1), l2 = linearIndex(i2), l3 = linearIndex(i3);
+	int simplexSign = signTet(zeroPoint, v1, v2, v3, l0, l1, l2, l3);
 
-	if (signTet(v0, zeroPoint, v2, v3, i0, i1, i2, i3) != simplexSign) {
+	if (signTet(v0, zeroPoint, v2, v3, l0, l1, l2, l3) != simplexSign) {
 		return 0;
 	}
-	if (signTet(v0, v1, zeroPoint, v3, i0, i1, i2, i3) != simplexSign) {
+	if (signTet(v0, v1, zeroPoint, v3, l0, l1, l2, l3) != simplexSign) {
 		return 0;
 	}
-	if (signTet(v0, v1, v2, zeroPoint, i0, i1, i2, i3) != simplexSign) {
+	if (signTet(v0, v1, v2, zeroPoint, l0, l1, l2, l3) != simplexSign) {
 		return 0;
 	}
 
@@ -191,72 +590,113 @@ int SphericalVectorField::criticalPointInTet(size_t i0, size_t i1, size_t i2, si
 	p2 << sphCoords(i2), 1.0;
 	p3 << sphCoords(i3), 1.0;
 
-	return (signTet(p0, p1, p2, p3, i0, i1, i2, i3) != simplexSign) ? -1 : 1;
+	return (signTet(p0, p1, p2, p3, l0, l1, l2, l3) != simplexSign) ? -1 : 1;
 }
 
 
-// Forward integrates streamline starting at given seed
+// Backward and forward integrates streamline starting at given seed
+// The line is built in place in a per thread scratch line that keeps its capacity between calls, so rejected
+// candidates cause no allocations. The backward half is reversed in place once done and the forward half appended
+// to it. Only accepted lines are copied out into exactly sized storage
 //
 // seed - starting seed point (lat, long, rad) in rads and mbars
 // totalTime - total amount of time to integrate forwards and backwards
 // tol - error tolerance
 // maxStep - maximum step size in seconds
 // vg - voxel grid containing points from streamlines already integrated
-// return - list of points in streamline in coordinates (lat, long, rad) in rads and mbars
-Streamline SphericalVectorField::streamline(const Eigen::Vector3d& seed, double maxDist, double tol, double maxStep,
-                                            const VoxelGrid& vg) const {
+// minLength - lines this length or shorter in metres are rejected
+// return - streamline, or nothing if it was too short
+std::optional<Streamline> SphericalVectorField::streamline(const Eigen::Vector3d& seed, double maxDist, double tol, double maxStep,
+                                                           const VoxelGrid& vg, double minLength) const {
 
-	Streamline forw(this);
-	Streamline back(this);
+	if (!inDomain(seed)) {
+		return std::nullopt;
+	}
+
+	thread_local Streamline line(nullptr);
+	line.reset(this);
+
+	// Velocity at the seed is the first RK stage of both directions. Cosine of latitude and radius are
+	// computed once per step and shared by all stages and the cartesian conversion
+	Eigen::Vector3d seedVel = velocityAt(seed);
+	double seedCosLat = cos(seed.x());
+	double seedAbsRadius = mbarsToAbs(seed.z());
 
 	Eigen::Vector3d currPos = seed;
+	Eigen::Vector3d currVel = seedVel;
+	double cosLat = seedCosLat;
+	double absRadius = seedAbsRadius;
 	double totalTime = 0.0;
-	double timeStep = maxStep;
+	double timeStep = -maxStep;
 	double length = 0.0;
 
-	// Forward integrate in time
-	forw.addPoint(currPos, (float)totalTime);
+	// Backward integrate in time
+	line.addPoint(currPos, (float)totalTime);
 	while (length < maxDist) {
 
-		currPos = RKF45Adaptive(currPos, timeStep, tol, maxStep);
-		Eigen::Vector3d currPosCart = sphToCart(currPos);
+		currPos = RKF45Adaptive(currPos, currVel, cosLat, absRadius, timeStep, tol, maxStep);
+		if (!inDomain(currPos)) {
+			break;
+		}
+		cosLat = cos(currPos.x());
+		absRadius = mbarsToAbs(currPos.z());
+
+		Eigen::Vector3d currPosCart = sphToCart(currPos, cosLat, absRadius);
 		if (!vg.testPoint(currPosCart)) {
 			break;
 		}
-		totalTime += timeStep;
-		forw.addPoint(currPos, currPosCart, (float)totalTime);
+		totalTime += -timeStep;
+		line.addPoint(currPos, currPosCart, (float)totalTime);
 
-		if (forw.getTotalLength() - length < 10.0 || timeStep == 0.0) {
+		if (line.getTotalLength() - length < 10.0 || timeStep == 0.0) {
 			break;
 		}
-		length = forw.getTotalLength();
+		length = line.getTotalLength();
+		currVel = velocityAt(currPos);
 	}
+
+	// Seed is now the last point and times count up from the start of the line
+	line.reverse();
+	double backLength = line.getTotalLength();
+	double timeOffset = totalTime;
+
 	currPos = seed;
+	currVel = seedVel;
+	cosLat = seedCosLat;
+	absRadius = seedAbsRadius;
 	totalTime = 0.0;
-	timeStep = -maxStep;
+	timeStep = maxStep;
 	length = 0.0;
 
-	// Backward integrate in time
-	back.addPoint(currPos, (float)totalTime);
-	while (back.getTotalLength() < maxDist) {
+	// Forward integrate in time
+	while (length < maxDist) {
+
+		currPos = RKF45Adaptive(currPos, currVel, cosLat, absRadius, timeStep, tol, maxStep);
+		if (!inDomain(currPos)) {
+			break;
+		}
+		cosLat = cos(currPos.x());
+		absRadius = mbarsToAbs(currPos.z());
 
-		currPos = RKF45Adaptive(currPos, timeStep, tol, maxStep);
-		Eigen::Vector3d currPosCart = sphToCart(currPos);
+		Eigen::Vector3d currPosCart = sphToCart(currPos, cosLat, absRadius);
 		if (!vg.testPoint(currPosCart)) {
 			break;
 		}
-		totalTime += -timeStep;
-		back.addPoint(currPos, currPosCart, (float)totalTime);
+		totalTime += timeStep;
+		line.addPoint(currPos, currPosCart, (float)(timeOffset + totalTime));
 
-		if (back.getTotalLength() - length < 10.0 || timeStep == 0.0) {
+		double newLength = line.getTotalLength() - backLength;
+		if (newLength - length < 10.0 || timeStep == 0.0) {
 			break;
 		}
-		length = back.getTotalLength();
+		length = newLength;
+		currVel = velocityAt(currPos);
 	}
 
-	// Combine forward and backward paths into one chronological path
-	Streamline streamline(back, forw, this);
-	return streamline;
+	if (line.getTotalLength() <= minLength) {
+		return std::nullopt;
+	}
+	return line;
 }
 
 
@@ -264,22 +704,26 @@ Streamline SphericalVectorField::streamline(const Eigen::Vector3d& seed, double
 // https://en.wikipedia.org/wiki/Runge%E2%80%93Kutta%E2%80%93Fehlberg_method
 //
 // currPos - current position (lat, long, rad) in rads and mbars
+// currVel - velocity at currPos, reused for the first stage of every attempt
+// cosLat - cosine of latitude of currPos
+// absRadius - distance of currPos from centre of Earth in metres
 // timeStep - current step size in and updated step size out. Gets set to 0 if it becomes prohibitively small
 // tol - error tolerance 
 // maxStep - maximum step size in seconds
 // return - next position (lat, long, rad) in rads and mbars
-Eigen::Vector3d SphericalVectorField::RKF45Adaptive(const Eigen::Vector3d& currPos, double& timeStep, double tol, double maxStep) const {
+Eigen::Vector3d SphericalVectorField::RKF45Adaptive(const Eigen::Vector3d& currPos, const Eigen::Vector3d& currVel, double cosLat,
+                                                    double absRadius, double& timeStep, double tol, double maxStep) const {
 
 	// Loop until error is low enough, almost always <= 2 itterations
 	while (true) {
-		double scaledStep = (param) ? timeStep * cos(currPos.x()) : timeStep;
+		double scaledStep = (param) ? timeStep * cosLat : timeStep;
 
-		Eigen::Vector3d k1 = scaledStep * velocityAt(currPos);
-		Eigen::Vector3d k2 = scaledStep * velocityAt(newPos(currPos, 1.0 / 4.0       * k1));
-		Eigen::Vector3d k3 = scaledStep * velocityAt(newPos(currPos, 3.0 / 32.0      * k1 + 9.0 / 32.0      * k2));
-		Eigen::Vector3d k4 = scaledStep * velocityAt(newPos(currPos, 1932.0 / 2197.0 * k1 - 7200.0 / 2197.0 * k2 + 7296.0 / 2197.0 * k3));
-		Eigen::Vector3d k5 = scaledStep * velocityAt(newPos(currPos, 439.0 / 216.0   * k1 - 8.0             * k2 + 3680.0 / 513.0  * k3 - 845.0 / 4104.0  * k4));
-		Eigen::Vector3d k6 = scaledStep * velocityAt(newPos(currPos, -8.0 / 27.0     * k1 + 2.0             * k2 - 3544.0 / 2565.0 * k3 + 1859.0 / 4104.0 * k4 - 11.0 / 40.0 * k5));
+		Eigen::Vector3d k1 = scaledStep * currVel;
+		Eigen::Vector3d k2 = scaledStep * velocityAt(newPos(currPos, 1.0 / 4.0       * k1, cosLat, absRadius));
+		Eigen::Vector3d k3 = scaledStep * velocityAt(newPos(currPos, 3.0 / 32.0      * k1 + 9.0 / 32.0      * k2, cosLat, absRadius));
+		Eigen::Vector3d k4 = scaledStep * velocityAt(newPos(currPos, 1932.0 / 2197.0 * k1 - 7200.0 / 2197.0 * k2 + 7296.0 / 2197.0 * k3, cosLat, absRadius));
+		Eigen::Vector3d k5 = scaledStep * velocityAt(newPos(currPos, 439.0 / 216.0   * k1 - 8.0             * k2 + 3680.0 / 513.0  * k3 - 845.0 / 4104.0  * k4, cosLat, absRadius));
+		Eigen::Vector3d k6 = scaledStep * velocityAt(newPos(currPos, -8.0 / 27.0     * k1 + 2.0             * k2 - 3544.0 / 2565.0 * k3 + 1859.0 / 4104.0 * k4 - 11.0 / 40.0 * k5, cosLat, absRadius));
 
 		Eigen::Vector3d highOrder = 16.0 / 135.0 * k1 + 6656.0 / 12825.0 * k3 + 28561.0 / 56430.0 * k4 - 9.0 / 50.0 * k5 + 2.0 / 55.0 * k6;
 		Eigen::Vector3d lowOrder = 25.0 / 216.0 * k1 + 1408.0 / 2665.0  * k3 + 2197.0 / 4104.0   * k4 - 1.0 / 5.0  * k5;
@@ -290,14 +734,14 @@ Eigen::Vector3d SphericalVectorField::RKF45Adaptive(const Eigen::Vector3d& currP
 
 		// Return if error is low enough
 		if (error < tol) {
-			return newPos(currPos, highOrder);
+			return newPos(currPos, highOrder, cosLat, absRadius);
 		}
 
 		// If time step is too small, terminate and indicate by setting timeStep to 0
 		else if (abs(timeStep) < 1.0) {
 
 			std::cout << "small step" << std::endl;
-			std::cout << velocityAt(currPos) << std::endl;
+			std::cout << currVel << std::endl;
 			timeStep = 0.0;
 			return currPos;
 		}
@@ -310,13 +754,47 @@ Eigen::Vector3d SphericalVectorField::RKF45Adaptive(const Eigen::Vector3d& currP
 // pos - (lat, long, altitude) in rads and mbars
 // return - (north, east, vertical) in m/s and Pa/s
 Eigen::Vector3d SphericalVectorField::velocityAt(const Eigen::Vector3d& pos) const {
+	return (this->*velocityAtFn)(pos);
+}
+
+
+// Returns vector data at lat, long, level index from the given storage
+// For fields read on demand the reference is only valid briefly, so copy the value right away
+//
+// lat - latitude index
+// lng - longitude index
+// lvl - level index
+// return - vector at index
+template<SphericalVectorField::Storage S>
+const Eigen::Vector3d& SphericalVectorField::corner(size_t lat, size_t lng, size_t lvl) const {
+	if constexpr (S == Storage::Cached) {
+		return bricks->at(lat, lng, lvl);
+	}
+	else {
+		return data[layoutOffset<(S == Storage::Linear) ? FieldLayout::Linear : FieldLayout::Bricked>(lat, lng, lvl)];
+	}
+}
+
+
+// Returns the velocity at the given position, reading corners from the given storage
+//
+// pos - (lat, long, altitude) in rads and mbars
+// return - (north, east, vertical) in m/s and Pa/s
+template<SphericalVectorField::Storage S>
+Eigen::Vector3d SphericalVectorField::velocityAtStorage(const Eigen::Vector3d& pos) const {
+
+	// Longitude is kept in [0, 2pi] so a conditional is enough to wrap it. Offset from first longitude of field
+	double lng = (pos.y() >= 2.0 * M_PI) ? pos.y() - 2.0 * M_PI : pos.y();
+	double lngOffset = (lng < longs[0]) ? lng - longs[0] + 2.0 * M_PI : lng - longs[0];
 
-	size_t latIndex = (size_t)(720.0 - (pos.x() + M_PI_2) * 4.0 * (180.0 / M_PI));
-	size_t longIndex = (size_t)(fmod(pos.y(), 2.0 * M_PI) * 4.0 * (180.0 / M_PI));
+	// Points outside a subset are clamped to its edge. Integration stops there anyway, this only keeps RK stages
+	// that overshoot the edge inside the data. Past the last latitude of a strided global field the last row is used
+	size_t latIndex = (size_t)std::clamp((lats[0] - pos.x()) * latsPerRad, 0.0, (double)(numLats - 1));
+	size_t longIndex = (size_t)std::min(lngOffset * longsPerRad, (double)(numLongs - 1));
 	size_t levelIndex = 0;
 
 	// Levels are non-uniform, use binary search to find appropriate index
-	size_t endIndex = NUM_LEVELS - 1;
+	size_t endIndex = numLevels - 1;
 	while (pos.z() >= levels[levelIndex + 1]) {
 
 		size_t mid = (levelIndex + endIndex) / 2;
@@ -326,8 +804,8 @@ Eigen::Vector3d SphericalVectorField::velocityAt(const Eigen::Vector3d& pos) con
 		else {
 			endIndex = mid;
 		}
-		if (levelIndex == NUM_LEVELS - 2) {
-			if (pos.z() >= levels[NUM_LEVELS - 1]) {
+		if (levelIndex == numLevels - 2) {
+			if (pos.z() >= levels[numLevels - 1]) {
 				levelIndex++;
 			}
 			break;
@@ -335,28 +813,36 @@ Eigen::Vector3d SphericalVectorField::velocityAt(const Eigen::Vector3d& pos) con
 	}
 
 	double latPerc, longPerc, levelPerc;
-	int latInc, levelInc;
+	int latInc, longInc, levelInc;
 
 	// Handle lat beyond end of grid
-	if (latIndex == NUM_LATS - 1) {
+	if (latIndex == numLats - 1) {
 		latPerc = 0.0;
 		latInc = 0;
 	}
 	else {
-		latPerc = (pos.x() - lats[latIndex]) / (lats[latIndex + 1] - lats[latIndex]);
+		latPerc = std::clamp((pos.x() - lats[latIndex]) / (lats[latIndex + 1] - lats[latIndex]), 0.0, 1.0);
 		latInc = 1;
 	}
 
-	// Handle long wrap around
-	if (longIndex == NUM_LONGS - 1) {
-		longPerc = (pos.y() - longs[longIndex]) / (2.0 * M_PI - longs[longIndex]);
+	// Handle long wrap around, or edge of subset
+	if (longIndex == numLongs - 1) {
+		if (wrapLongs) {
+			longPerc = (lngOffset - (longs[longIndex] - longs[0])) / (2.0 * M_PI - (longs[longIndex] - longs[0]));
+			longInc = 1;
+		}
+		else {
+			longPerc = 0.0;
+			longInc = 0;
+		}
 	}
 	else {
-		longPerc = (pos.y() - longs[longIndex]) / (longs[longIndex + 1] - longs[longIndex]);
+		longPerc = (lngOffset - (longs[longIndex] - longs[0])) / (longs[longIndex + 1] - longs[longIndex]);
+		longInc = 1;
 	}
 
 	// Handle level at end of grid
-	if (levelIndex == NUM_LEVELS - 1) {
+	if (levelIndex == numLevels - 1) {
 		levelPerc = 0.0;
 		levelInc = 0;
 	}
@@ -366,14 +852,14 @@ Eigen::Vector3d SphericalVectorField::velocityAt(const Eigen::Vector3d& pos) con
 	}
 
 	// 8 corners of hexahedron
-	Eigen::Vector3d _000 = (*this)(latIndex, longIndex, levelIndex);
-	Eigen::Vector3d _001 = (*this)(latIndex, longIndex, levelIndex + levelInc);
-	Eigen::Vector3d _010 = (*this)(latIndex, (longIndex + 1) % NUM_LONGS, levelIndex);
-	Eigen::Vector3d _011 = (*this)(latIndex, (longIndex + 1) % NUM_LONGS, levelIndex + levelInc);
-	Eigen::Vector3d _100 = (*this)(latIndex + latInc, longIndex, levelIndex);
-	Eigen::Vector3d _101 = (*this)(latIndex + latInc, longIndex, levelIndex + levelInc);
-	Eigen::Vector3d _110 = (*this)(latIndex + latInc, (longIndex + 1) % NUM_LONGS, levelIndex);
-	Eigen::Vector3d _111 = (*this)(latIndex + latInc, (longIndex + 1) % NUM_LONGS, levelIndex + levelInc);
+	Eigen::Vector3d _000 = corner<S>(latIndex, longIndex, levelIndex);
+	Eigen::Vector3d _001 = corner<S>(latIndex, longIndex, levelIndex + levelInc);
+	Eigen::Vector3d _010 = corner<S>(latIndex, (longIndex + longInc) % numLongs, levelIndex);
+	Eigen::Vector3d _011 = corner<S>(latIndex, (longIndex + longInc) % numLongs, levelIndex + levelInc);
+	Eigen::Vector3d _100 = corner<S>(latIndex + latInc, longIndex, levelIndex);
+	Eigen::Vector3d _101 = corner<S>(latIndex + latInc, longIndex, levelIndex + levelInc);
+	Eigen::Vector3d _110 = corner<S>(latIndex + latInc, (longIndex + longInc) % numLongs, levelIndex);
+	Eigen::Vector3d _111 = corner<S>(latIndex + latInc, (longIndex + longInc) % numLongs, levelIndex + levelInc);
 	
 	// Multiply each point by its total contribution
 	_000 *= (1.0 - latPerc) * (1.0 - longPerc) * (1.0 - levelPerc);
@@ -406,21 +892,81 @@ Eigen::Vector3d SphericalVectorField::velocityAtM(const Eigen::Vector3d& pos) co
 }
 
 
+// Returns whether a position is inside the loaded part of the field. Latitude is not checked if the field spans all
+// latitudes, since with a stride the last loaded latitude can fall short of the pole and lines crossing it should
+// carry on. Level is only ever outside for seeds, positions after a step are clamped to the levels
+//
+// pos - (lat, long, altitude) in rads and mbars
+// return - true if inside
+bool SphericalVectorField::inDomain(const Eigen::Vector3d& pos) const {
+
+	if (pos.z() < levels[0] || pos.z() > levels.back()) {
+		return false;
+	}
+
+	// Tolerance since latitudes are converted from degrees and may be just inside the poles
+	if (!clampLats && (pos.x() > lats[0] + 1e-9 || pos.x() < lats.back() - 1e-9)) {
+		return false;
+	}
+	if (wrapLongs) {
+		return true;
+	}
+	double lng = (pos.y() >= 2.0 * M_PI) ? pos.y() - 2.0 * M_PI : pos.y();
+	double lngOffset = (lng < longs[0]) ? lng - longs[0] + 2.0 * M_PI : lng - longs[0];
+	return lngOffset <= longs.back() - longs[0];
+}
+
+
+// Returns the centre of the loaded part of the field
+//
+// return - (lat, long, altitude) in rads and mbars
+Eigen::Vector3d SphericalVectorField::domainCentre() const {
+
+	double lng = 0.5 * (longs[0] + longs.back());
+	return Eigen::Vector3d(0.5 * (lats[0] + lats.back()), fmod(lng, 2.0 * M_PI), 0.5 * (levels[0] + levels.back()));
+}
+
+
+// Returns the coarsest pyramid level with cells no larger than maxCellM, or the field itself if there is none
+//
+// maxCellM - largest cell allowed, as distance between latitudes on the surface in metres
+// return - field to integrate on
+const SphericalVectorField& SphericalVectorField::coarsest(double maxCellM) const {
+
+	const SphericalVectorField* f = this;
+	for (const std::unique_ptr<SphericalVectorField>& p : pyramid) {
+		if (RADIUS_EARTH_M / p->latsPerRad > maxCellM) {
+			break;
+		}
+		f = p.get();
+	}
+	return *f;
+}
+
+
+// Returns number of bricks in memory for a field read on demand
+//
+// return - number of bricks, 0 if the field is held in memory
+size_t SphericalVectorField::residentBricks() const {
+	return bricks ? bricks->residentBricks() : 0;
+}
+
+
 // Calculates new position from current position and velocity
 //
 // currPos - (lat, long, altitude) in rads and mbars
 // velocity - (north, east, vertical) in m/s and Pa/s
+// cosLat - cosine of latitude of currPos
+// absRadius - distance of currPos from centre of Earth in metres
 // return - (lat, long, altitude) in rads and mbars
-Eigen::Vector3d SphericalVectorField::newPos(const Eigen::Vector3d& currPos, const Eigen::Vector3d& velocity) const {
+Eigen::Vector3d SphericalVectorField::newPos(const Eigen::Vector3d& currPos, const Eigen::Vector3d& velocity,
+                                             double cosLat, double absRadius) const {
 
 	Eigen::Vector3d newPos;
-	double absRadius = mbarsToAbs(currPos.z());
-
-	double cosLat = cos(currPos.x());
 
 	// TODO singularities at poles, how to account for this? Doing in physical space is not stable (trig on small angles)
 	newPos.x() = currPos.x() + velocity.x() / absRadius;
-	newPos.y() = (cosLat > 0.0001) ? currPos.y() + velocity.y() / (cos(currPos.x()) * absRadius) : currPos.y();
+	newPos.y() = (cosLat > 0.0001) ? currPos.y() + velocity.y() / (cosLat * absRadius) : currPos.y();
 	newPos.z() = currPos.z() + 0.01 * velocity.z();
 
 	// Clamp and wrap around
@@ -428,7 +974,7 @@ Eigen::Vector3d SphericalVectorField::newPos(const Eigen::Vector3d& currPos, con
 	newPos.z() = std::clamp(newPos.z(), (double)levels[0], (double)levels.back());
 
 	while (newPos.y() < 0.0) newPos.y() += 2.0 * M_PI;
-	while (newPos.y() > 2.0 * M_PI) newPos.y() -= 2.0 * M_PI;
+	while (newPos.y() >= 2.0 * M_PI) newPos.y() -= 2.0 * M_PI;
 
 	return newPos;
 }
@@ -468,12 +1014,29 @@ Eigen::Vector3d SphericalVectorField::sphCoords(const Eigen::Matrix<size_t, 3, 1
 // i - absolute 1D index
 // return - (lat, long, level) index
 Eigen::Matrix<size_t, 3, 1> SphericalVectorField::offsetToIndex(size_t i) const {
+	return (this->*offsetToIndexFn)(i);
+}
 
-	Eigen::Matrix<size_t, 3, 1> v;
-	v.x() = (i / NUM_LONGS) % NUM_LATS;
-	v.y() = i % NUM_LONGS;
-	v.z() = (i / NUM_LONGS) / NUM_LATS;
 
+// Converts absolute index to lat, long, level index for a given layout
+//
+// i - absolute 1D index
+// return - (lat, long, level) index
+template<FieldLayout L>
+Eigen::Matrix<size_t, 3, 1> SphericalVectorField::layoutIndex(size_t i) const {
+
+	Eigen::Matrix<size_t, 3, 1> v;
+	if constexpr (L == FieldLayout::Linear) {
+		v.x() = (i / numLongs) % numLats;
+		v.y() = i % numLongs;
+		v.z() = (i / numLongs) / numLats;
+	}
+	else {
+		size_t brick = i >> 6;
+		v.x() = (((brick / longBricks) % latBricks) << 2) + ((i >> 2) & 3);
+		v.y() = ((brick % longBricks) << 2) + (i & 3);
+		v.z() = ((brick / longBricks / latBricks) << 2) + ((i >> 4) & 3);
+	}
 	return v;
 }
 
@@ -485,7 +1048,25 @@ Eigen::Matrix<size_t, 3, 1> SphericalVectorField::offsetToIndex(size_t i) const
 // lvl - level index
 // return - absolute 1D index
 size_t SphericalVectorField::indexToOffset(size_t lat, size_t lng, size_t lvl) const {
-	return lng + NUM_LONGS * (lat + NUM_LATS * lvl);
+	return (this->*indexToOffsetFn)(lat, lng, lvl);
+}
+
+
+// Converts lat, long, level index to absolute index for a given layout
+//
+// lat - latitude index
+// lng - longitude index
+// lvl - level index
+// return - absolute 1D index
+template<FieldLayout L>
+size_t SphericalVectorField::layoutOffset(size_t lat, size_t lng, size_t lvl) const {
+	if constexpr (L == FieldLayout::Linear) {
+		return lng + numLongs * (lat + numLats * lvl);
+	}
+	else {
+		size_t brick = (lng >> 2) + longBricks * ((lat >> 2) + latBricks * (lvl >> 2));
+		return (brick << 6) + ((lvl & 3) << 4) + ((lat & 3) << 2) + (lng & 3);
+	}
 }
 
 
@@ -498,7 +1079,7 @@ size_t SphericalVectorField::indexToOffset(const Eigen::Matrix<size_t, 3, 1>& i)
 }
 
 
-// Returns vector data at absolute index
+// Returns vector data at absolute index. Only for fields held in memory
 //
 // i - absolute 1D index
 // return - vector at index
@@ -508,15 +1089,20 @@ Eigen::Vector3d& SphericalVectorField::operator()(size_t i) {
 
 
 // Returns vector data at absolute index
+// For fields read on demand the reference is only valid briefly, so copy the value right away
 //
 // i - absolute 1D index
 // return - vector at index
 const Eigen::Vector3d& SphericalVectorField::operator()(size_t i) const {
+	if (bricks) {
+		Eigen::Matrix<size_t, 3, 1> index = offsetToIndex(i);
+		return bricks->at(index.x(), index.y(), index.z());
+	}
 	return data[i];
 }
 
 
-// Returns vector data at lat, long, level index
+// Returns vector data at lat, long, level index. Only for fields held in memory
 //
 // lat - latitude index
 // lng - longitude index
@@ -528,12 +1114,16 @@ Eigen::Vector3d& SphericalVectorField::operator()(size_t lat, size_t lng, size_t
 
 
 // Returns vector data at lat, long, level index
+// For fields read on demand the reference is only valid briefly, so copy the value right away
 //
 // lat - latitude index
 // lng - longitude index
 // lvl - level index
 // return - vector at index
 const Eigen::Vector3d& SphericalVectorField::operator()(size_t lat, size_t lng, size_t lvl) const {
+	if (bricks) {
+		return bricks->at(lat, lng, lvl);
+	}
 	return data[indexToOffset(lat, lng, lvl)];
 }
 
@@ -1,34 +1,75 @@
 #pragma once
 
+class BrickCache;
 class Streamline;
 class VoxelGrid;
 
 #include <Eigen/Dense>
 #include <netcdf>
 
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+
+// Part of the file's grid to load. Latitudes and longitudes in degrees, levels in mbars. The longitude box may cross
+// 0, e.g. 280 to 20 for the North Atlantic. Stride keeps every stride-th latitude and longitude
+struct FieldSubset {
+	double minLat = -90.0;
+	double maxLat = 90.0;
+	double minLng = 0.0;
+	double maxLng = 360.0;
+	double minLevel = 0.0;
+	double maxLevel = 1000.0;
+	size_t stride = 1;
+};
+
+
+// Order of points in memory. Bricked keeps blocks of 4x4x4 (lat, long, level) points together, so the corners of a
+// cell and its neighbours share cache lines instead of being spread over rows and whole level planes
+enum class FieldLayout {
+	Linear,
+	Bricked
+};
+
 
 // Class for managing spherical vector field on Earth
 // TODO currently hard-coded for specific grid format
 class SphericalVectorField {
 
 public:
+	// Grid of the files, the field itself may hold a subset
 	static const size_t NUM_LEVELS = 37;
 	static const size_t NUM_LATS = 721;
 	static const size_t NUM_LONGS = 1440;
 
+	// Number of downsampled copies, each halving latitudes and longitudes
+	static const int NUM_PYRAMID_LEVELS = 3;
+
 	bool param = true;
 
-	SphericalVectorField() = default;
-	SphericalVectorField(const netCDF::NcFile& file);
+	SphericalVectorField();
+	SphericalVectorField(const netCDF::NcFile& file, const FieldSubset& subset = FieldSubset(),
+	                     FieldLayout layout = FieldLayout::Linear, double maxCellM = 0.0);
+	SphericalVectorField(const std::string& path, const FieldSubset& subset, size_t cacheBytes);
 
 	std::vector<std::pair<Eigen::Matrix<size_t, 3, 1>, int>> findCriticalPoints() const;
 
-	Streamline streamline(const Eigen::Vector3d& seed, double maxDist, double tol, double maxStep,
-	                      const VoxelGrid& vg) const;
+	std::optional<Streamline> streamline(const Eigen::Vector3d& seed, double maxDist, double tol, double maxStep,
+	                                     const VoxelGrid& vg, double minLength = 0.0) const;
 	Eigen::Vector3d velocityAt(const Eigen::Vector3d& pos) const;
 	Eigen::Vector3d velocityAtM(const Eigen::Vector3d& pos) const;
 
+	bool inDomain(const Eigen::Vector3d& pos) const;
+	Eigen::Vector3d domainCentre() const;
+	const SphericalVectorField& coarsest(double maxCellM) const;
+	size_t residentBricks() const;
+
 	int level(size_t i) { return levels[i]; }
+	size_t getNumLats() const { return numLats; }
+	size_t getNumLongs() const { return numLongs; }
+	size_t getNumLevels() const { return numLevels; }
 	Eigen::Vector3d sphCoords(size_t i) const;
 	Eigen::Vector3d sphCoords(size_t lat, size_t lng, size_t lvl) const;
 	Eigen::Vector3d sphCoords(const Eigen::Matrix<size_t, 3, 1>& i) const;
@@ -47,18 +88,90 @@ public:
 	const Eigen::Vector3d& operator()(const Eigen::Matrix<size_t, 3, 1>& i) const;
 
 private:
+	// Where the field lies in the file's grid and how its values are packed, for reading parts of it
+	struct FileGrid {
+		netCDF::NcVar vars[3];
+		double scales[3];
+		double offsets[3];
+		size_t numDims;
+		size_t chunkLevels;
+		size_t chunkLats;
+		size_t chunkLongs;
+		size_t firstLvl;
+		size_t firstLat;
+		size_t firstLng;
+		size_t stride;
+	};
+
+	// NetCDF is not thread safe. Guards all reads made by fields
+	static std::mutex netCDFMutex;
+
+	// Hash table size of NetCDF chunk caches. HDF5 suggests a prime well above the number of chunks held
+	static const size_t CHUNK_CACHE_SLOTS = 1009;
+
+	// Either all data is held in memory or bricks of it are read on demand
 	std::vector<Eigen::Vector3d> data;
+	std::shared_ptr<BrickCache> bricks;
+
+	FieldLayout layout = FieldLayout::Linear;
+	size_t latBricks = 0;
+	size_t longBricks = 0;
+
+	// Where velocityAt reads corners from
+	enum class Storage {
+		Linear,
+		Bricked,
+		Cached
+	};
+
+	// Picked once per field by pickAccessors, so lookups do not branch on layout or storage
+	size_t (SphericalVectorField::*indexToOffsetFn)(size_t, size_t, size_t) const;
+	Eigen::Matrix<size_t, 3, 1> (SphericalVectorField::*offsetToIndexFn)(size_t) const;
+	Eigen::Vector3d (SphericalVectorField::*velocityAtFn)(const Eigen::Vector3d&) const;
 
 	std::vector<int> levels;
 	std::vector<double> lats;
 	std::vector<double> longs;
 
+	size_t numLevels = 0;
+	size_t numLats = 0;
+	size_t numLongs = 0;
+
+	// Whether longitudes go all the way around, otherwise the last longitude is the edge of the domain
+	bool wrapLongs = true;
+
+	// Whether the field spans all latitudes of the file, so positions past the first or last loaded latitude are
+	// clamped to it rather than out of the domain
+	bool clampLats = true;
+	double latsPerRad = 0.0;
+	double longsPerRad = 0.0;
+
+	// Downsampled copies for integrating coarse seeding levels. Only built for fields loaded from a file
+	std::vector<std::unique_ptr<SphericalVectorField>> pyramid;
+
+	SphericalVectorField downsample() const;
+	void initLayout(FieldLayout newLayout);
+	void pickAccessors();
+	size_t linearIndex(size_t i) const;
+
+	template<FieldLayout L> size_t layoutOffset(size_t lat, size_t lng, size_t lvl) const;
+	template<FieldLayout L> Eigen::Matrix<size_t, 3, 1> layoutIndex(size_t i) const;
+	template<Storage S> const Eigen::Vector3d& corner(size_t lat, size_t lng, size_t lvl) const;
+	template<Storage S> Eigen::Vector3d velocityAtStorage(const Eigen::Vector3d& pos) const;
+
+	FileGrid openGrid(const netCDF::NcFile& file, const FieldSubset& subset);
+	static void readRegion(const FileGrid& g, size_t lvl, size_t numLvls, size_t lat, size_t numLts,
+	                       size_t lng, size_t numLngs, std::vector<short> raw[3], size_t runCount[2]);
+	static void decodeRow(const FileGrid& g, const std::vector<short> raw[3], const size_t runCount[2],
+	                      size_t numRows, size_t row, Eigen::Vector3d* dest);
+
 	int signTet(const Eigen::Vector4d& v0, const Eigen::Vector4d& v1,
 	            const Eigen::Vector4d& v2, const Eigen::Vector4d& v3,
 	            size_t i0, size_t i1, size_t i2, size_t i3) const;
 
 	int criticalPointInTet(size_t i0, size_t i1, size_t i2, size_t i3) const;
-	Eigen::Vector3d newPos(const Eigen::Vector3d& currPos, const Eigen::Vector3d& velocity) const;
-	Eigen::Vector3d RKF45Adaptive(const Eigen::Vector3d& currPos, double& timeStep, double tol, double maxStep) const;
+	Eigen::Vector3d newPos(const Eigen::Vector3d& currPos, const Eigen::Vector3d& velocity, double cosLat, double absRadius) const;
+	Eigen::Vector3d RKF45Adaptive(const Eigen::Vector3d& currPos, const Eigen::Vector3d& currVel, double cosLat,
+	                              double absRadius, double& timeStep, double tol, double maxStep) const;
 };
 
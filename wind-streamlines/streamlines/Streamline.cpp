@@ -1,15 +1,15 @@
 #include "Streamline.h"
 
-#include "color/ColorSpace.h"
 #include "Conversions.h"
 #include "SphericalVectorField.h"
 
+#include <algorithm>
+
 
 // Default constructor
 //
 // field - Spherical vector field the streamline belongs to
 Streamline::Streamline(const SphericalVectorField* field) :
-	totalTime(0.f),
 	sumAlt(0.0),
 	totalLength(0.0),
 	totalAngle(0.0),
@@ -17,30 +17,16 @@ Streamline::Streamline(const SphericalVectorField* field) :
 	field(field) {}
 
 
-// Construct streamline from forward and backwards lines integrated at the same seed point
+// Removes all points and resets totals. Keeps allocated capacity so the line can be reused as scratch space
 //
-// back - backwards integrated streamline
-// forw - forward integrated streamline
-// field - Spherical vector field the streamline belongs to
-Streamline::Streamline(const Streamline& back, const Streamline& forw, const SphericalVectorField* field) :
-	points(back.size() + forw.size()),
-	localTimes(back.size() + forw.size()),
-	totalTime(back.totalTime + forw.totalTime),
-	sumAlt(back.sumAlt + forw.sumAlt),
-	totalLength(back.totalLength + forw.totalLength),
-	totalAngle(back.totalAngle + forw.totalAngle),
-	render(nullptr),
-	field(field) {
-
-	for (size_t i = 0; i < back.size(); i++) {
-		points[i] = back.points[back.size() - 1 - i];
-		localTimes[i] = back.totalTime - back.localTimes[back.size() - 1 - i];
-	}
-
-	for (size_t i = 0; i < forw.size(); i++) {
-		points[back.size() + i] = forw.points[i];
-		localTimes[back.size() + i] = forw.localTimes[i] + back.totalTime;;
-	}
+// field - Spherical vector field the next line belongs to
+void Streamline::reset(const SphericalVectorField* field) {
+	this->field = field;
+	points.clear();
+	localTimes.clear();
+	sumAlt = 0.0;
+	totalLength = 0.0;
+	totalAngle = 0.0;
 }
 
 
@@ -80,7 +66,23 @@ void Streamline::addPoint(const Eigen::Vector3d& pSph, const Eigen::Vector3d& pC
 	}
 	points.push_back(pCart);
 	localTimes.push_back(time);
-	totalTime += time;
+}
+
+
+// Reverses the direction of the line in place. Times are mirrored so they still increase along the line
+// Totals do not depend on direction so they are unchanged
+void Streamline::reverse() {
+
+	if (points.empty()) {
+		return;
+	}
+	std::reverse(points.begin(), points.end());
+	std::reverse(localTimes.begin(), localTimes.end());
+
+	float endTime = localTimes.front();
+	for (float& t : localTimes) {
+		t = endTime - t;
+	}
 }
 
 
@@ -88,7 +90,7 @@ void Streamline::addPoint(const Eigen::Vector3d& pSph, const Eigen::Vector3d& pC
 //
 // sepDist - seperation distance seeds are from line
 // return - list of candidate seed points in cartesian coordinates
-std::vector<Eigen::Vector3d> Streamline::getSeeds(double sepDist) {
+std::vector<Eigen::Vector3d> Streamline::getSeeds(double sepDist) const {
 
 	std::vector<Eigen::Vector3d> seeds;
 
@@ -138,76 +140,44 @@ std::vector<Eigen::Vector3d> Streamline::getSeeds(double sepDist) {
 }
 
 
-// Adds the streamline to a renderable object
-//
-// r - renderable to add steamline geometry to
-void Streamline::createRenderable(const glm::vec3& c1, const glm::vec3& c2) {
+// Creates the renderable geometry for the streamline. Colour is applied on the GPU
+// Output is sized up front and written by index, so lines can be built in parallel
+void Streamline::createRenderable() {
 
 	if (render != nullptr) {
 		delete render;
 	}
-	render = new StreamlineRenderable();
-	render->setDrawMode(GL_LINES);
-
-	double maxAlt = mbarsToAlt(1.0);
-	ColorSpace::Rgb lowRGB(c1.x, c1.y, c1.z);
-	ColorSpace::Rgb highRGB(c2.x, c2.y, c2.z);
-
-	ColorSpace::Lab lowLab;
-	ColorSpace::Lab highLab;
-
-	lowLab.Initialize(&lowRGB);
-	highLab.Initialize(&highRGB);
 
-	ColorSpace::Lab lab;
-	ColorSpace::Rgb RGB;
+	// Non-end points are duplicated for drawing lines
+	size_t n = size();
+	size_t numInner = (n > 3) ? n - 3 : 0;
+	render = new StreamlineRenderable(2 + 2 * numInner);
 
 	// First point
 	Eigen::Vector3d cart0 = points[0];
 	Eigen::Vector3d tangent0 = (points[1] - cart0).normalized();
-	double n0 = (cart0.norm() - RADIUS_EARTH_M) / maxAlt;
-	lab.l = (1.0 - n0) * lowLab.l + n0 * highLab.l;
-	lab.a = (1.0 - n0) * lowLab.a + n0 * highLab.a;
-	lab.b = (1.0 - n0) * lowLab.b + n0 * highLab.b;
-	lab.ToRgb(&RGB);
+	render->setVert(0, glm::dvec3(cart0.x(), cart0.y(), cart0.z()), glm::vec3(tangent0.x(), tangent0.y(), tangent0.z()), localTimes[0]);
 
-	render->addVert(glm::dvec3(cart0.x(), cart0.y(), cart0.z()));
-	render->addColour(glm::u8vec3(255 * (RGB.r / 1.0), 255 * (RGB.g / 1.0), 255 * (RGB.b / 1.0)));
-	render->addTangent(glm::vec3(tangent0.x(), tangent0.y(), tangent0.z()));
-	render->addLocalTime(localTimes[0]);
-
-	// Non-end point geometry is duplicated for drawing lines
-	for (size_t i = 1; i < size() - 2; i++) {
+	for (size_t i = 1; i <= numInner; i++) {
 
 		Eigen::Vector3d cart = points[i];
 		Eigen::Vector3d tangent = (points[i + 1] - points[i - 1]).normalized();
-		double n = (cart.norm() - RADIUS_EARTH_M) / maxAlt;
-		lab.l = (1.0 - n) * lowLab.l + n * highLab.l;
-		lab.a = (1.0 - n) * lowLab.a + n * highLab.a;
-		lab.b = (1.0 - n) * lowLab.b + n * highLab.b;
-		lab.ToRgb(&RGB);
-
-		render->addVert(glm::dvec3(cart.x(), cart.y(), cart.z()));
-		render->addVert(glm::dvec3(cart.x(), cart.y(), cart.z()));
-		render->addColour(glm::u8vec3(255 * (RGB.r / 1.0), 255 * (RGB.g / 1.0), 255 * (RGB.b / 1.0)));
-		render->addColour(glm::u8vec3(255 * (RGB.r / 1.0), 255 * (RGB.g / 1.0), 255 * (RGB.b / 1.0)));
-		render->addTangent(glm::vec3(tangent.x(), tangent.y(), tangent.z()));
-		render->addTangent(glm::vec3(tangent.x(), tangent.y(), tangent.z()));
-		render->addLocalTime(localTimes[i]);
-		render->addLocalTime(localTimes[i]);
+
+		glm::dvec3 v(cart.x(), cart.y(), cart.z());
+		glm::vec3 t(tangent.x(), tangent.y(), tangent.z());
+		render->setVert(2 * i - 1, v, t, localTimes[i]);
+		render->setVert(2 * i, v, t, localTimes[i]);
 	}
 
 	// Last point
 	Eigen::Vector3d cartE = points.back();
-	Eigen::Vector3d tangentE = (cartE - points[size() - 2]).normalized();
-	double nE = (cartE.norm() - RADIUS_EARTH_M) / maxAlt;
-	lab.l = (1.0 - nE) * lowLab.l + nE * highLab.l;
-	lab.a = (1.0 - nE) * lowLab.a + nE * highLab.a;
-	lab.b = (1.0 - nE) * lowLab.b + nE * highLab.b;
-	lab.ToRgb(&RGB);
-
-	render->addVert(glm::dvec3(cartE.x(), cartE.y(), cartE.z()));
-	render->addColour(glm::u8vec3(255 * (RGB.r / 1.0), 255 * (RGB.g / 1.0), 255 * (RGB.b / 1.0)));
-	render->addTangent(glm::vec3(tangentE.x(), tangentE.y(), tangentE.z()));
-	render->addLocalTime(localTimes.back());
+	Eigen::Vector3d tangentE = (cartE - points[n - 2]).normalized();
+	render->setVert(2 * numInner + 1, glm::dvec3(cartE.x(), cartE.y(), cartE.z()), glm::vec3(tangentE.x(), tangentE.y(), tangentE.z()), localTimes.back());
+}
+
+
+// Deletes the renderable for the streamline if it has one
+void Streamline::deleteRenderable() {
+	delete render;
+	render = nullptr;
 }
\ No newline at end of file
@@ -14,11 +14,13 @@ class Streamline {
 
 public:
 	Streamline(const SphericalVectorField* field);
-	Streamline(const Streamline& back, const Streamline& forw, const SphericalVectorField* field);
 
+	void reset(const SphericalVectorField* field);
 	void addPoint(const Eigen::Vector3d& pSph, float time);
 	void addPoint(const Eigen::Vector3d& pSph, const Eigen::Vector3d& pCart, float time);
+	void reverse();
 	const std::vector<Eigen::Vector3d>& getPoints() const { return points; }
+	const std::vector<float>& getLocalTimes() const { return localTimes; }
 	size_t size() const { return points.size(); }
 
 	double getSumAlt() const { return sumAlt; }
@@ -26,15 +28,15 @@ public:
 	double getTotalAngle() const { return totalAngle; }
 	StreamlineRenderable* getRender() { return render; }
 
-	std::vector<Eigen::Vector3d> getSeeds(double sepDist);
+	std::vector<Eigen::Vector3d> getSeeds(double sepDist) const;
 
-	void createRenderable(const glm::vec3& c1, const glm::vec3& c2);
+	void createRenderable();
+	void deleteRenderable();
 
 private:
 	std::vector<Eigen::Vector3d> points;
 	std::vector<float> localTimes;
 
-	float totalTime;
 	double sumAlt;
 	double totalLength;
 	double totalAngle;
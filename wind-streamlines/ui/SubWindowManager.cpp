@@ -38,7 +38,7 @@ void SubWindowManager::renderAll(SeedingEngine& seeder, const std::vector<Render
 
 	for (SubWindow* s : windows) {
 
-		lines = seeder.getLinesToRender(s->getFrustum(), s->getCameraDist());
+		lines = seeder.getLinesToRender(s->getFrustum());
 		for (Renderable* r : objects) {
 			lines.push_back(r);
 		}